@@ -0,0 +1,506 @@
+/*
+ * Microbenchmarks for the filesystem and disk layers.
+ *
+ * Every result is printed as one JSON object per line so runs can be diffed
+ * and compared across releases:
+ *
+ *   ./build/fs_bench [image-path] > bench_output.txt
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs.h"
+#include "disk.h"
+
+#define FILE_BLOCKS 1024
+#define FILE_SIZE ((size_t)FILE_BLOCKS * BLOCK_SIZE)
+
+static char *image_path = "bench.img";
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t next_random()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void fail(const char *what)
+{
+    fprintf(stderr, "fs_bench: %s failed\n", what);
+    exit(1);
+}
+
+static void setup(int nblocks)
+{
+    if (disk_init(image_path, nblocks) < 0)
+        fail("disk_init");
+    if (fs_format() < 0)
+        fail("fs_format");
+    if (fs_mount() < 0)
+        fail("fs_mount");
+}
+
+static void teardown()
+{
+    fs_unmount();
+    disk_close(0);
+}
+
+/**
+ * Starts a timed section: clears the counters so the report only covers the
+ * operations being measured.
+ */
+static uint64_t begin()
+{
+    fs_reset_stats();
+    return stats_now_ns();
+}
+
+static void report(const char *name, const char *params, uint64_t start, uint64_t ops, uint64_t bytes)
+{
+    uint64_t elapsed = stats_now_ns() - start;
+    struct fs_stats stats;
+    fs_get_stats(&stats);
+
+    double seconds = elapsed / 1e9;
+    printf("{\"bench\":\"%s\",\"params\":{%s},\"ops\":%llu,\"bytes\":%llu,\"ns\":%llu,"
+           "\"ns_per_op\":%.1f,\"ops_per_sec\":%.1f,\"mb_per_sec\":%.2f,"
+           "\"disk_reads\":%llu,\"disk_writes\":%llu,\"checksum_ns\":%llu}\n",
+           name, params, (unsigned long long)ops, (unsigned long long)bytes, (unsigned long long)elapsed,
+           ops ? (double)elapsed / ops : 0.0,
+           seconds > 0 ? ops / seconds : 0.0,
+           seconds > 0 ? bytes / seconds / (1024.0 * 1024.0) : 0.0,
+           (unsigned long long)stats.disk.reads, (unsigned long long)stats.disk.writes,
+           (unsigned long long)stats.disk.checksum_ns);
+    fflush(stdout);
+}
+
+static void bench_create_flat()
+{
+    const int files = 200;
+    char path[256];
+
+    setup(4096);
+    if (fs_create("/flat", 1) < 0)
+        fail("fs_create");
+
+    uint64_t start = begin();
+    for (int i = 0; i < files; i++)
+    {
+        snprintf(path, sizeof(path), "/flat/f%d", i);
+        if (fs_create(path, 0) < 0)
+            fail("fs_create");
+    }
+    report("create_flat", "\"files\":200", start, files, 0);
+    teardown();
+}
+
+static void bench_create_batch()
+{
+    const int files = 200;
+    char names[200][16];
+    const char *name_list[200];
+
+    setup(4096);
+    if (fs_create("/flat", 1) < 0)
+        fail("fs_create");
+    for (int i = 0; i < files; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "f%d", i);
+        name_list[i] = names[i];
+    }
+
+    uint64_t start = begin();
+    if (fs_create_batch("/flat", name_list, files, 0) < 0)
+        fail("fs_create_batch");
+    report("create_batch", "\"files\":200", start, files, 0);
+
+    start = begin();
+    if (fs_remove_batch("/flat", name_list, files) < 0)
+        fail("fs_remove_batch");
+    report("remove_batch", "\"files\":200", start, files, 0);
+    teardown();
+}
+
+static void bench_rename_publish()
+{
+    const int files = 100;
+    static char data[256 * 1024];
+    char tmp_path[256], path[256];
+
+    setup(8192);
+    if (fs_create("/staging", 1) < 0 || fs_create("/published", 1) < 0)
+        fail("fs_create");
+    memset(data, 'r', sizeof(data));
+
+    uint64_t start = begin();
+    for (int i = 0; i < files; i++)
+    {
+        snprintf(tmp_path, sizeof(tmp_path), "/staging/f%d.tmp", i % 4);
+        snprintf(path, sizeof(path), "/published/f%d", i % 4);
+        if (fs_write(tmp_path, data, sizeof(data), 0) < 0)
+            fail("fs_write");
+        if (fs_rename(tmp_path, path) < 0)
+            fail("fs_rename");
+    }
+    report("write_rename", "\"files\":100,\"size\":262144", start, files, (uint64_t)files * sizeof(data));
+    teardown();
+}
+
+static void bench_create_deep(int depth)
+{
+    const int files = 100;
+    char dir[256] = "";
+    char path[256];
+    char params[64];
+
+    setup(4096);
+    for (int d = 0; d < depth; d++)
+    {
+        strcat(dir, "/d");
+        if (fs_create(dir, 1) < 0)
+            fail("fs_create");
+    }
+
+    uint64_t start = begin();
+    for (int i = 0; i < files; i++)
+    {
+        snprintf(path, sizeof(path), "%s/f%d", dir, i);
+        if (fs_create(path, 0) < 0)
+            fail("fs_create");
+    }
+    snprintf(params, sizeof(params), "\"depth\":%d,\"files\":%d", depth, files);
+    report("create_deep", params, start, files, 0);
+    teardown();
+}
+
+static void bench_io(size_t chunk)
+{
+    char *buf = malloc(chunk);
+    size_t chunks = FILE_SIZE / chunk;
+    char params[64];
+
+    if (!buf)
+        fail("malloc");
+    memset(buf, 0xA5, chunk);
+    snprintf(params, sizeof(params), "\"chunk\":%zu,\"file_size\":%zu", chunk, FILE_SIZE);
+
+    setup(4096);
+
+    uint64_t start = begin();
+    for (size_t i = 0; i < chunks; i++)
+    {
+        if (fs_pwrite("/file", buf, chunk, i * chunk) < 0)
+            fail("fs_pwrite");
+    }
+    report("write_seq", params, start, chunks, FILE_SIZE);
+
+    start = begin();
+    for (size_t i = 0; i < chunks; i++)
+    {
+        if (fs_read("/file", buf, chunk, i * chunk) < 0)
+            fail("fs_read");
+    }
+    report("read_seq", params, start, chunks, FILE_SIZE);
+
+    start = begin();
+    for (size_t i = 0; i < chunks; i++)
+    {
+        if (fs_pwrite("/file", buf, chunk, (next_random() % chunks) * chunk) < 0)
+            fail("fs_pwrite");
+    }
+    report("write_rand", params, start, chunks, FILE_SIZE);
+
+    start = begin();
+    for (size_t i = 0; i < chunks; i++)
+    {
+        if (fs_read("/file", buf, chunk, (next_random() % chunks) * chunk) < 0)
+            fail("fs_read");
+    }
+    report("read_rand", params, start, chunks, FILE_SIZE);
+
+    teardown();
+    free(buf);
+}
+
+/**
+ * Reads a file sequentially with block checksum verification on or off, so
+ * the difference between the two runs is the cost of verifying.
+ */
+static void bench_verify(int verify)
+{
+    const size_t chunk = 65536;
+    char *buf = malloc(chunk);
+    char params[64];
+
+    if (!buf)
+        fail("malloc");
+    memset(buf, 0x5A, chunk);
+    snprintf(params, sizeof(params), "\"verify\":%d,\"chunk\":%zu", verify, chunk);
+
+    setup(4096);
+    for (size_t offset = 0; offset < FILE_SIZE; offset += chunk)
+    {
+        if (fs_pwrite("/file", buf, chunk, offset) < 0)
+            fail("fs_pwrite");
+    }
+
+    disk_set_verify(verify);
+    uint64_t start = begin();
+    for (size_t offset = 0; offset < FILE_SIZE; offset += chunk)
+    {
+        if (fs_read("/file", buf, chunk, offset) < 0)
+            fail("fs_read");
+    }
+    report("read_verify", params, start, FILE_SIZE / chunk, FILE_SIZE);
+
+    disk_set_verify(1);
+    teardown();
+    free(buf);
+}
+
+/**
+ * Writes and then reads a file sequentially with the disk in buffered or
+ * direct mode. Direct mode skips the host page cache, so the reads go to the
+ * device instead of being served from a second cached copy.
+ */
+static void bench_direct(int direct)
+{
+    const size_t chunk = 65536;
+    char *buf = malloc(chunk);
+    char params[64];
+
+    if (!buf)
+        fail("malloc");
+    memset(buf, 0x3C, chunk);
+    snprintf(params, sizeof(params), "\"direct\":%d,\"chunk\":%zu", direct, chunk);
+
+    setup(4096);
+    if (direct && disk_set_direct(1) < 0)
+    {
+        fprintf(stderr, "fs_bench: direct I/O not supported for '%s', skipped\n", image_path);
+        teardown();
+        free(buf);
+        return;
+    }
+
+    uint64_t start = begin();
+    for (size_t offset = 0; offset < FILE_SIZE; offset += chunk)
+    {
+        if (fs_pwrite("/file", buf, chunk, offset) < 0)
+            fail("fs_pwrite");
+    }
+    report("write_direct", params, start, FILE_SIZE / chunk, FILE_SIZE);
+
+    start = begin();
+    for (size_t offset = 0; offset < FILE_SIZE; offset += chunk)
+    {
+        if (fs_read("/file", buf, chunk, offset) < 0)
+            fail("fs_read");
+    }
+    report("read_direct", params, start, FILE_SIZE / chunk, FILE_SIZE);
+
+    teardown();
+    free(buf);
+}
+
+/**
+ * Writes a file block by block where `duplicate_pct` percent of the blocks
+ * repeat one of a few templates (half of those are zero pages), with
+ * deduplication on or off. Inline hashing has to pay for itself in saved
+ * writes for the duplicate-heavy runs.
+ */
+static void bench_dedup(int dedup, int duplicate_pct)
+{
+    char *buf = malloc(BLOCK_SIZE);
+    char params[64];
+
+    if (!buf)
+        fail("malloc");
+    snprintf(params, sizeof(params), "\"dedup\":%d,\"duplicate_pct\":%d", dedup, duplicate_pct);
+
+    setup(4096);
+    fs_set_dedup(dedup);
+
+    uint64_t start = begin();
+    for (size_t i = 0; i < FILE_BLOCKS; i++)
+    {
+        uint64_t r = next_random();
+        if ((int)(r % 100) < duplicate_pct)
+        {
+            memset(buf, (r >> 8) % 2 ? 0 : (int)((r >> 16) % 4) + 1, BLOCK_SIZE);
+        }
+        else
+        {
+            for (size_t w = 0; w < BLOCK_SIZE; w += sizeof(uint64_t))
+            {
+                uint64_t word = next_random();
+                memcpy(buf + w, &word, sizeof(word));
+            }
+        }
+
+        if (fs_pwrite("/file", buf, BLOCK_SIZE, i * BLOCK_SIZE) < 0)
+            fail("fs_pwrite");
+    }
+    report("write_dedup", params, start, FILE_BLOCKS, FILE_SIZE);
+
+    fs_set_dedup(0);
+    teardown();
+    free(buf);
+}
+
+/**
+ * Writes and reads back a file of log-like text, stored plain or compressed.
+ * The text repeats a handful of line templates with varying numbers, which
+ * compresses at roughly the ratio of real service logs.
+ */
+static void bench_compress(int compressed)
+{
+    static const char *templates[] = {
+        "2026-10-18T12:00:%02u.%03uZ INFO request handled path=/api/v1/items status=200 ms=%u\n",
+        "2026-10-18T12:00:%02u.%03uZ WARN slow query table=orders rows=%u\n",
+        "2026-10-18T12:00:%02u.%03uZ DEBUG cache lookup key=user:%u hit=1\n",
+    };
+    const size_t chunk = FS_CLUSTER_SIZE;
+    char *text = malloc(FILE_SIZE + 256);
+    char params[64];
+
+    if (!text)
+        fail("malloc");
+
+    size_t used = 0;
+    while (used < FILE_SIZE)
+    {
+        uint64_t r = next_random();
+        used += snprintf(text + used, 256, templates[r % 3], (unsigned)(r >> 8) % 60,
+                         (unsigned)(r >> 16) % 1000, (unsigned)(r >> 32) % 5000);
+    }
+    snprintf(params, sizeof(params), "\"compressed\":%d,\"chunk\":%zu", compressed, chunk);
+
+    setup(4096);
+    if (fs_create("/log", 0) < 0 || fs_set_compression("/log", compressed) < 0)
+        fail("fs_set_compression");
+
+    struct fs_stats stats;
+    fs_get_stats(&stats);
+    uint32_t free_before = stats.free_blocks;
+
+    uint64_t start = begin();
+    for (size_t offset = 0; offset < FILE_SIZE; offset += chunk)
+    {
+        if (fs_pwrite("/log", text + offset, chunk, offset) < 0)
+            fail("fs_pwrite");
+    }
+    report("write_compress", params, start, FILE_SIZE / chunk, FILE_SIZE);
+
+    fs_get_stats(&stats);
+    printf("{\"bench\":\"compress_space\",\"params\":{%s},\"blocks\":%u}\n", params,
+           free_before - stats.free_blocks);
+
+    start = begin();
+    for (size_t offset = 0; offset < FILE_SIZE; offset += chunk)
+    {
+        if (fs_read("/log", text, chunk, offset) < 0)
+            fail("fs_read");
+    }
+    report("read_compress", params, start, FILE_SIZE / chunk, FILE_SIZE);
+
+    teardown();
+    free(text);
+}
+
+static void bench_format_mount(int nblocks)
+{
+    char params[64];
+    snprintf(params, sizeof(params), "\"blocks\":%d", nblocks);
+
+    if (disk_init(image_path, nblocks) < 0)
+        fail("disk_init");
+
+    uint64_t start = begin();
+    if (fs_format() < 0)
+        fail("fs_format");
+    report("format", params, start, 1, 0);
+
+    start = begin();
+    if (fs_mount() < 0)
+        fail("fs_mount");
+    report("mount", params, start, 1, 0);
+
+    teardown();
+}
+
+static void bench_remove_tree()
+{
+    const int dirs = 8;
+    const int subdirs = 8;
+    const int files = 10;
+    char path[256];
+
+    setup(8192);
+    for (int i = 0; i < dirs; i++)
+    {
+        for (int j = 0; j < subdirs; j++)
+        {
+            for (int k = 0; k < files; k++)
+            {
+                snprintf(path, sizeof(path), "/tree/d%d/s%d/f%d", i, j, k);
+                if (fs_write(path, path, strlen(path), 0) < 0)
+                    fail("fs_write");
+            }
+        }
+    }
+
+    uint64_t start = begin();
+    if (fs_remove("/tree") < 0)
+        fail("fs_remove");
+    report("remove_tree", "\"dirs\":73,\"files\":640", start, 1, 0);
+    teardown();
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+        image_path = argv[1];
+
+    fs_set_log_level(FS_LOG_OFF);
+
+    bench_create_flat();
+    bench_create_batch();
+    bench_rename_publish();
+    bench_create_deep(1);
+    bench_create_deep(16);
+    bench_create_deep(64);
+
+    bench_io(512);
+    bench_io(4096);
+    bench_io(65536);
+
+    bench_verify(0);
+    bench_verify(1);
+
+    bench_direct(0);
+    bench_direct(1);
+
+    bench_dedup(0, 0);
+    bench_dedup(1, 0);
+    bench_dedup(0, 50);
+    bench_dedup(1, 50);
+
+    bench_compress(0);
+    bench_compress(1);
+
+    bench_format_mount(1024);
+    bench_format_mount(4096);
+    bench_format_mount(16384);
+    bench_format_mount(32768);
+
+    bench_remove_tree();
+
+    remove(image_path);
+    return 0;
+}
@@ -0,0 +1,32 @@
+/**
+ * @file crc32c.h
+ * @brief This header file contains the declarations of the block checksum helpers.
+ *
+ * Block checksums use CRC32C (Castagnoli). On x86-64 CPUs with SSE4.2 the
+ * crc32 instruction processes eight bytes per cycle; elsewhere a slice-by-8
+ * table implementation is used. The choice is made once, at first use.
+ *
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Computes the CRC32C of a buffer.
+ *
+ * @param crc The CRC of the preceding bytes, or 0 to start a new checksum.
+ * @param data The bytes to checksum.
+ * @param len The number of bytes.
+ * @return uint32_t The updated CRC.
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+/**
+ * @brief Returns 1 if crc32c() uses the hardware instruction, 0 otherwise.
+ */
+int crc32c_hardware();
+
+#endif
@@ -15,6 +15,67 @@
 
 #define BLOCK_SIZE 4096 // 4 KB
 
+struct disk_stats
+{
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t discarded_blocks;
+    uint64_t checksum_errors;
+    uint64_t checksum_ns;
+    uint64_t direct_bounces;    // direct I/O accesses copied through an aligned buffer
+};
+
+/**
+ * The structure a block access belongs to, as reported by the caller through
+ * disk_set_tag(). Used to attribute I/O in block traces.
+ */
+enum disk_tag
+{
+    DISK_TAG_UNKNOWN,
+    DISK_TAG_SUPERBLOCK,
+    DISK_TAG_BITMAP,
+    DISK_TAG_INODE,
+    DISK_TAG_DIRECTORY,
+    DISK_TAG_DATA,
+    DISK_TAG_INDIRECT,
+    DISK_TAG_REFCOUNT,
+    DISK_TAG_COUNT
+};
+
+enum disk_trace_op
+{
+    DISK_TRACE_READ,
+    DISK_TRACE_WRITE,
+    DISK_TRACE_DISCARD
+};
+
+struct disk_trace_entry
+{
+    uint64_t timestamp_ns;
+    uint32_t blocknum;
+    uint8_t op;
+    uint8_t tag;
+    uint16_t count;
+};
+
+#define DISK_TRACE_MAGIC 0x43525444u // "DTRC"
+#define DISK_TRACE_VERSION 1
+
+/**
+ * Header of a block trace dump. It is followed by `entries` disk_trace_entry
+ * records, oldest first.
+ */
+struct disk_trace_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t disk_blocks;
+    uint32_t entries;
+    uint64_t dropped;
+};
+
 /**
  * @brief Initializes a virtual disk with the given filename and number of blocks.
  *
@@ -37,7 +98,11 @@ int disk_size();
  * @param blocknum The block number to start reading from.
  * @param buf A pointer to the buffer to read the data into.
  *
- * @return int The number of bytes read, or -1 if an error occurred.
+ * Every block carries a CRC32C that disk_write() keeps current. Unless
+ * verification is turned off with disk_set_verify(), a block whose contents
+ * no longer match its checksum is reported as an error.
+ *
+ * @return int The number of bytes read, or -1 if an error occurred or the checksum did not match.
  */
 int disk_read(uint32_t blocknum, void *buf);
 
@@ -50,9 +115,108 @@ int disk_read(uint32_t blocknum, void *buf);
  */
 int disk_write(uint32_t blocknum, void *buf);
 
+/**
+ * @brief Releases a range of blocks to the host by punching a hole in the disk image.
+ *
+ * The blocks read back as zeros afterwards. This is only a space optimization:
+ * callers must not rely on it succeeding.
+ *
+ * @param blocknum The first block of the range.
+ * @param count The number of blocks in the range.
+ * @return int Returns 0 on success, -1 if the range is invalid or hole punching is unsupported.
+ */
+int disk_discard(uint32_t blocknum, uint32_t count);
+
+/**
+ * @brief Copies the disk I/O counters into `stats`.
+ *
+ * @param stats The structure to fill.
+ */
+void disk_get_stats(struct disk_stats *stats);
+
+/**
+ * @brief Resets the disk I/O counters to zero.
+ */
+void disk_reset_stats();
+
+/**
+ * @brief Turns checksum verification on reads on or off.
+ *
+ * Checksums are still updated on writes while verification is off, so it can
+ * be turned back on at any time. Verification is on by default.
+ *
+ * @param enable 1 to verify reads, 0 to skip verification.
+ */
+void disk_set_verify(int enable);
+
+/**
+ * @brief Switches the open disk between buffered and direct (O_DIRECT) I/O.
+ *
+ * Direct I/O bypasses the host page cache, so blocks are not cached a second
+ * time under the filesystem's own caches. Buffers should be aligned to
+ * BLOCK_SIZE; an unaligned buffer still works but is copied through an
+ * aligned one, which is counted in disk_stats.direct_bounces. A disk starts
+ * out buffered after disk_init(), and the checksum table is always written
+ * buffered by disk_sync() and disk_close().
+ *
+ * @param enable 1 for direct I/O, 0 for buffered I/O.
+ * @return int Returns 0 on success, -1 if the disk is not open or the host file system does not support direct I/O.
+ */
+int disk_set_direct(int enable);
+
+/**
+ * @brief Sets the tag recorded for subsequent block accesses.
+ *
+ * @param tag The structure the following reads and writes belong to.
+ */
+void disk_set_tag(enum disk_tag tag);
+
+/**
+ * @brief Returns the name of a block tag.
+ */
+const char *disk_tag_name(enum disk_tag tag);
+
+/**
+ * @brief Starts recording block accesses into a ring buffer.
+ *
+ * Once the ring is full the oldest entries are overwritten. Calling this again
+ * discards the current trace.
+ *
+ * @param capacity The number of entries to keep; rounded up to a power of two.
+ * @return int Returns 0 on success, -1 if the ring could not be allocated.
+ */
+int disk_trace_enable(uint32_t capacity);
+
+/**
+ * @brief Stops recording block accesses and frees the ring buffer.
+ */
+void disk_trace_disable();
+
+/**
+ * @brief Writes the trace ring to a file, oldest entry first.
+ *
+ * @param filename The file to create.
+ * @return int Returns 0 on success, -1 if tracing is off or the file could not be written.
+ */
+int disk_trace_dump(const char *filename);
+
+/**
+ * @brief Writes the changed parts of the checksum table to the image.
+ *
+ * The table follows the last block, one 32-bit CRC32C per block. disk_init()
+ * stores it for the fresh image, but later checksums are kept in memory until
+ * disk_sync() or disk_close(). If the process dies in between, blocks written
+ * since then no longer match the table on disk.
+ *
+ * @return int Returns 0 on success, -1 if the disk is not open or the table could not be written.
+ */
+int disk_sync();
+
 /**
  * @brief Closes the disk file and frees any allocated memory.
  *
+ * The checksum table is brought up to date first, as by disk_sync().
+ *
  * @param log 1 if the disk operations should be logged, 0 otherwise.
  * @return int Returns 0 on success, -1 on failure.
  */
@@ -9,9 +9,15 @@
 #include <stddef.h>
 #include <sys/types.h>
 #include "disk.h"
+#include "stats.h"
+#include "log.h"
+#include "trace.h"
 
-#define BLOCK_SIZE 4096
-#define INODE_DIRECT_POINTERS 12
+#define FS_SEEK_DATA 3
+#define FS_SEEK_HOLE 4
+
+#define FS_MAX_SNAPSHOTS 8
+#define FS_SNAPSHOT_NAME_LEN 32
 
 struct directory_entry
 {
@@ -19,6 +25,13 @@ struct directory_entry
     char name[MAX_NAME_LEN];
 } __attribute__((packed));
 
+struct snapshot_record
+{
+    char name[FS_SNAPSHOT_NAME_LEN];
+    uint32_t inode_table_start;
+    uint32_t inode_bitmap;
+};
+
 struct superblock
 {
     uint32_t s_blocks_count;
@@ -27,20 +40,35 @@ struct superblock
     uint32_t s_inode_bitmap;
     uint32_t s_inode_table_block_start;
     uint32_t s_data_blocks_start;
+    uint32_t s_unwritten_bitmap;
+    uint32_t s_refcount_table_start;
+    uint32_t s_refcount_table_blocks;
+    struct snapshot_record s_snapshots[FS_MAX_SNAPSHOTS];
 };
 
 #define INODE_DIRECT_POINTERS 13
 
+#define FS_INODE_COMPRESSED 0x01
+
+#define FS_CLUSTER_BLOCKS 4
+#define FS_CLUSTER_SIZE (FS_CLUSTER_BLOCKS * BLOCK_SIZE)
+#define FS_PTR_COMPRESSED 0xFFFFFFFFu
+
 struct inode
 {
     uint32_t i_size;
     uint32_t i_direct_pointers[INODE_DIRECT_POINTERS];
     uint32_t i_indirect_pointer;
     uint8_t i_is_directory;
-    uint8_t padding[3];
+    uint8_t i_flags;
+    uint8_t padding[2];
 };
 
-union block
+/*
+ * Block buffers are aligned to the block size, as direct I/O requires (see
+ * disk_set_direct()). This holds for locals and statics as well.
+ */
+union __attribute__((aligned(BLOCK_SIZE))) block
 {
     struct superblock superblock;
     struct inode inodes[BLOCK_SIZE / sizeof(struct inode)];
@@ -50,14 +78,62 @@ union block
     uint32_t pointers[MAX_POINTERS];
 };
 
+struct fs_dirent
+{
+    uint32_t inode;
+    uint8_t is_directory;
+    uint64_t size;
+    char name[MAX_NAME_LEN];
+};
+
+struct fs_attr
+{
+    uint32_t parent;
+    uint32_t file_count;
+    uint32_t direct_blocks;
+    uint8_t has_indirect;
+};
+
+struct fs_dirent_plus
+{
+    struct fs_dirent entry;
+    struct fs_attr attr;
+};
+
+struct fs_dir;
+
 int fs_format();
 int fs_mount();
+int fs_mount_snapshot(const char *name);
 void fs_unmount();
 int fs_create(const char *path, int is_directory);
 int fs_list(const char *path);
+struct fs_dir *fs_opendir(const char *path);
+int fs_readdir(struct fs_dir *dir, struct fs_dirent *entries, size_t max);
+int fs_readdir_plus(struct fs_dir *dir, struct fs_dirent_plus *entries, size_t max);
+uint64_t fs_telldir(struct fs_dir *dir);
+void fs_seekdir(struct fs_dir *dir, uint64_t cookie);
+void fs_closedir(struct fs_dir *dir);
 int fs_remove(const char *path);
+int fs_create_batch(const char *parent, const char *const *names, size_t count, int is_directory);
+int fs_remove_batch(const char *parent, const char *const *names, size_t count);
 int fs_write(const char *path, const void *buf, size_t count, int append);
+int fs_pwrite(const char *path, const void *buf, size_t count, off_t offset);
+int fs_truncate(const char *path, off_t size);
 int fs_read(const char *path, void *buf, size_t count, off_t offset);
+off_t fs_seek(const char *path, off_t offset, int whence);
+int fs_fallocate(const char *path, off_t offset, off_t len);
+int fs_clone(const char *src_path, const char *dst_path);
+int fs_rename(const char *old_path, const char *new_path);
+int fs_set_compression(const char *path, int enable);
+int fs_get_usage(const char *path, uint64_t *bytes, uint32_t *files);
+void fs_set_discard(int enable);
+void fs_set_dedup(int enable);
+int fs_snapshot_create(const char *name);
+int fs_snapshot_delete(const char *name);
 void fs_stat();
+int fs_get_stats(struct fs_stats *stats);
+void fs_reset_stats();
+int fs_export_stats(char *buf, size_t len);
 
 #endif
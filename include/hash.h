@@ -0,0 +1,27 @@
+/**
+ * @file hash.h
+ * @brief This header file contains the declarations of the block hashing helpers.
+ *
+ * Block fingerprints use XXH64: four independent 64-bit lanes per 32-byte
+ * stripe, so a 4 KiB block hashes at several bytes per cycle without any
+ * instruction-set specific code.
+ *
+ */
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Computes the XXH64 hash of a buffer.
+ *
+ * @param data The bytes to hash.
+ * @param len The number of bytes.
+ * @param seed The hash seed.
+ * @return uint64_t The 64-bit hash.
+ */
+uint64_t hash_xxh64(const void *data, size_t len, uint64_t seed);
+
+#endif
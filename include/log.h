@@ -0,0 +1,63 @@
+/**
+ * @file log.h
+ * @brief This header file contains the declarations of the pluggable logging hook.
+ *
+ * Diagnostics from the filesystem and disk layers go through FS_LOG() instead
+ * of printf. Messages below the runtime threshold cost one comparison, and
+ * messages below FS_LOG_COMPILE_LEVEL are removed by the compiler entirely.
+ *
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+enum fs_log_level
+{
+    FS_LOG_DEBUG,
+    FS_LOG_INFO,
+    FS_LOG_WARN,
+    FS_LOG_ERROR,
+    FS_LOG_OFF
+};
+
+/**
+ * Levels below this are compiled out. Build with -DFS_LOG_COMPILE_LEVEL=FS_LOG_OFF
+ * to remove all logging from the binary.
+ */
+#ifndef FS_LOG_COMPILE_LEVEL
+#define FS_LOG_COMPILE_LEVEL FS_LOG_DEBUG
+#endif
+
+/**
+ * @brief Receives one formatted log message (without a trailing newline).
+ */
+typedef void (*fs_log_handler)(enum fs_log_level level, const char *message, void *context);
+
+extern enum fs_log_level fs_log_threshold;
+
+#define FS_LOG(level, ...)                                                  \
+    do                                                                      \
+    {                                                                       \
+        if ((level) >= FS_LOG_COMPILE_LEVEL && (level) >= fs_log_threshold) \
+            fs_log_write((level), __VA_ARGS__);                             \
+    } while (0)
+
+/**
+ * @brief Installs a log handler.
+ *
+ * @param handler The handler to call, or NULL to restore the default handler, which prints to stdout.
+ * @param context An opaque pointer passed to the handler.
+ */
+void fs_set_log_handler(fs_log_handler handler, void *context);
+
+/**
+ * @brief Sets the minimum level that is delivered to the handler. The default is FS_LOG_WARN.
+ */
+void fs_set_log_level(enum fs_log_level level);
+
+/**
+ * @brief Formats a message and delivers it to the handler. Use FS_LOG() instead.
+ */
+void fs_log_write(enum fs_log_level level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#endif
@@ -0,0 +1,41 @@
+/**
+ * @file lz.h
+ * @brief This header file contains the declarations of the LZ block codec.
+ *
+ * A byte-oriented LZ77 codec in the style of LZ4: each sequence is a token
+ * holding a literal length and a match length, the literals, and a 16-bit
+ * back-reference offset. Matches are found through a single-probe hash table,
+ * which makes compression fast enough for the write path and decompression a
+ * simple copy loop.
+ *
+ */
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Compresses `len` bytes from `src` into `dst`.
+ *
+ * @param src The input.
+ * @param len The input length.
+ * @param dst The output buffer.
+ * @param capacity The size of the output buffer.
+ * @return size_t The compressed length, or 0 if it would not fit in `capacity`.
+ */
+size_t lz_compress(const void *src, size_t len, void *dst, size_t capacity);
+
+/**
+ * @brief Decompresses `len` bytes from `src` into `dst`.
+ *
+ * @param src The compressed input.
+ * @param len The compressed length.
+ * @param dst The output buffer.
+ * @param capacity The size of the output buffer.
+ * @return long The decompressed length, or -1 if the input is malformed.
+ */
+long lz_decompress(const void *src, size_t len, void *dst, size_t capacity);
+
+#endif
@@ -0,0 +1,75 @@
+/**
+ * @file slab.h
+ * @brief This header file contains the declarations of the slab allocator for fixed-size filesystem objects.
+ *
+ * Objects the filesystem allocates and frees on every call, such as block
+ * buffers and directory handles, come from one slab per kind instead of
+ * malloc. A slab carves its objects out of large aligned chunks that are kept
+ * for the life of the process. Freed objects go onto a free list owned by the
+ * calling thread, so most allocations take no lock; threads trade objects with
+ * the slab's shared list in batches.
+ *
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum fs_slab
+{
+    FS_SLAB_BLOCK,
+    FS_SLAB_DIR_HANDLE,
+    FS_SLAB_COUNT
+};
+
+struct fs_slab_stats
+{
+    uint32_t object_size;
+    uint64_t reserved_bytes;    // memory held in chunks, used or not
+    uint64_t in_use;
+    uint64_t allocs;
+    uint64_t refills;   // batches a thread took from the shared list
+};
+
+/**
+ * @brief Sets the object size and alignment of a slab.
+ *
+ * Calling it again with the same size and alignment does nothing.
+ *
+ * @param slab The slab.
+ * @param object_size The size of one object in bytes.
+ * @param align The alignment of every object, a power of two.
+ * @return int 0 on success, -1 if the slab was already set up differently.
+ */
+int slab_init(enum fs_slab slab, size_t object_size, size_t align);
+
+/**
+ * @brief Allocates one object, or returns NULL if the slab is not set up or memory is exhausted.
+ */
+void *slab_alloc(enum fs_slab slab);
+
+/**
+ * @brief Returns an object to the slab it was allocated from. NULL is ignored.
+ */
+void slab_free(enum fs_slab slab, void *object);
+
+/**
+ * @brief Hands the calling thread's free objects back to the shared lists.
+ *
+ * Threads that allocated from a slab should call it before they exit.
+ */
+void slab_thread_flush();
+
+/**
+ * @brief Copies the counters of every slab into `stats`, which holds FS_SLAB_COUNT entries.
+ */
+void slab_collect(struct fs_slab_stats *stats);
+
+/**
+ * @brief Returns the name of a slab as used in exported metrics.
+ */
+const char *slab_name(enum fs_slab slab);
+
+#endif
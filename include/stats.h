@@ -0,0 +1,120 @@
+/**
+ * @file stats.h
+ * @brief This header file contains the declarations of the filesystem statistics surface.
+ *
+ * The filesystem counts every public operation and records its latency in a
+ * log2 histogram. Together with the volume, disk and slab counters, the numbers are
+ * returned by fs_get_stats() and can be exported in the Prometheus text format.
+ *
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "disk.h"
+#include "slab.h"
+
+/**
+ * Latency histogram bucket i counts operations that took less than 2^i
+ * nanoseconds (and at least 2^(i-1)); the last bucket also holds everything
+ * slower.
+ */
+#define FS_LATENCY_BUCKETS 32
+
+enum fs_op
+{
+    FS_OP_CREATE,
+    FS_OP_READ,
+    FS_OP_WRITE,
+    FS_OP_REMOVE,
+    FS_OP_LOOKUP,
+    FS_OP_RENAME,
+    FS_OP_COUNT
+};
+
+enum fs_cache
+{
+    FS_CACHE_BMAP,
+    FS_CACHE_DEDUP,
+    FS_CACHE_CLUSTER,
+    FS_CACHE_COUNT
+};
+
+struct fs_op_stats
+{
+    uint64_t count;
+    uint64_t errors;
+    uint64_t total_ns;
+    uint64_t histogram[FS_LATENCY_BUCKETS];
+};
+
+struct fs_cache_stats
+{
+    uint64_t hits;
+    uint64_t misses;
+};
+
+struct fs_stats
+{
+    uint32_t total_blocks;
+    uint32_t free_blocks;
+    uint32_t pending_free_blocks;
+    uint32_t total_inodes;
+    uint32_t free_inodes;
+    struct fs_op_stats ops[FS_OP_COUNT];
+    struct fs_cache_stats caches[FS_CACHE_COUNT];
+    struct disk_stats disk;
+    struct fs_slab_stats slabs[FS_SLAB_COUNT];
+};
+
+/**
+ * @brief Returns a monotonic timestamp in nanoseconds.
+ */
+uint64_t stats_now_ns();
+
+/**
+ * @brief Records one completed operation.
+ *
+ * @param op The operation.
+ * @param start_ns The timestamp returned by stats_now_ns() when the operation started.
+ * @param result The operation's return value; negative values count as errors.
+ */
+void stats_record_op(enum fs_op op, uint64_t start_ns, long result);
+
+/**
+ * @brief Records one cache lookup.
+ *
+ * @param cache The cache that was consulted.
+ * @param hit 1 if the lookup was served from the cache, 0 otherwise.
+ */
+void stats_record_cache(enum fs_cache cache, int hit);
+
+/**
+ * @brief Copies the operation and cache counters into `stats`.
+ */
+void stats_collect(struct fs_stats *stats);
+
+/**
+ * @brief Clears the operation and cache counters.
+ */
+void stats_reset();
+
+/**
+ * @brief Returns the name of an operation as used in exported metrics.
+ */
+const char *stats_op_name(enum fs_op op);
+
+/**
+ * @brief Formats `stats` in the Prometheus text exposition format.
+ *
+ * @param stats The statistics to format.
+ * @param buf The output buffer.
+ * @param len The size of the output buffer.
+ * @return int The length of the full output (as snprintf), or -1 on error.
+ */
+int stats_format_prometheus(const struct fs_stats *stats, char *buf, size_t len);
+
+#endif
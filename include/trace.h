@@ -0,0 +1,128 @@
+/**
+ * @file trace.h
+ * @brief This header file contains the declarations of the operation tracing layer.
+ *
+ * When tracing is enabled, every top-level fs_* call is appended to a compact
+ * binary trace: the operation, the path, the offset and size, the latency and
+ * the time since the previous call. Operations on two paths, rename and clone,
+ * also record the second one. Paths are interned, so each distinct path
+ * is stored once and later records refer to it by id. The fs_replay tool reads
+ * traces back through the reader functions declared here.
+ *
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC 0x52545346u // "FSTR"
+#define TRACE_VERSION 3 // older traces are read too: version 1 has no two-path ops, version 2 no fallocate
+
+enum trace_op
+{
+    TRACE_CREATE,
+    TRACE_MKDIR,
+    TRACE_READ,
+    TRACE_WRITE,
+    TRACE_APPEND,
+    TRACE_PWRITE,
+    TRACE_REMOVE,
+    TRACE_TRUNCATE,
+    TRACE_RENAME,
+    TRACE_CLONE,
+    TRACE_FALLOCATE,
+    TRACE_OP_COUNT
+};
+
+struct trace_event
+{
+    enum trace_op op;
+    int failed;
+    const char *path;
+    const char *target;     // second path of a two-path op, NULL otherwise
+    uint64_t offset;
+    uint64_t size;
+    uint64_t latency_ns;
+    uint64_t delta_ns;
+};
+
+struct trace_reader;
+
+extern int trace_enabled;
+extern int trace_depth;
+
+/**
+ * Records a completed call if tracing is on and the call was not made from
+ * inside another traced call (fs_write creating its parent directories, for
+ * example), so a replay issues exactly the calls the application made.
+ */
+#define TRACE_OP(op, path, offset, size, start_ns, result)                  \
+    do                                                                      \
+    {                                                                       \
+        if (trace_enabled && trace_depth == 0)                              \
+            trace_record((op), (path), (offset), (size), (start_ns), (result)); \
+    } while (0)
+
+/**
+ * Like TRACE_OP(), for an operation from `path` to `target`.
+ */
+#define TRACE_OP_PAIR(op, path, target, start_ns, result)                  \
+    do                                                                      \
+    {                                                                       \
+        if (trace_enabled && trace_depth == 0)                              \
+            trace_record_pair((op), (path), (target), (start_ns), (result)); \
+    } while (0)
+
+/**
+ * @brief Starts writing a trace to `filename`, replacing any existing file.
+ *
+ * @return int Returns 0 on success, -1 on failure.
+ */
+int fs_trace_start(const char *filename);
+
+/**
+ * @brief Flushes and closes the current trace.
+ *
+ * @return int Returns 0 on success, -1 if no trace was active or the flush failed.
+ */
+int fs_trace_stop();
+
+/**
+ * @brief Appends one record to the active trace. Use TRACE_OP() instead.
+ */
+void trace_record(enum trace_op op, const char *path, uint64_t offset, uint64_t size, uint64_t start_ns, long result);
+
+/**
+ * @brief Appends one record with two paths to the active trace. Use TRACE_OP_PAIR() instead.
+ */
+void trace_record_pair(enum trace_op op, const char *path, const char *target, uint64_t start_ns, long result);
+
+/**
+ * @brief Opens a trace file for reading.
+ *
+ * @return struct trace_reader* The reader, or NULL if the file is missing or not a trace.
+ */
+struct trace_reader *trace_reader_open(const char *filename);
+
+/**
+ * @brief Reads the next operation from the trace.
+ *
+ * The event's paths stay valid until the reader is closed.
+ *
+ * @return int Returns 1 if an event was read, 0 at the end of the trace, -1 if the trace is corrupt.
+ */
+int trace_reader_next(struct trace_reader *reader, struct trace_event *event);
+
+/**
+ * @brief Closes the reader and frees its path table.
+ */
+void trace_reader_close(struct trace_reader *reader);
+
+/**
+ * @brief Returns the name of a trace operation.
+ */
+const char *trace_op_name(enum trace_op op);
+
+#endif
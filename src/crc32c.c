@@ -0,0 +1,186 @@
+#include <string.h>
+
+#include "crc32c.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CRC32C_HAVE_SSE42 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78u // reflected Castagnoli polynomial
+#define CRC32C_LANE 1344        // bytes per stream when three streams run in parallel
+
+static uint32_t crc_table[8][256];
+static uint32_t shift_table[4][256];    // advances a CRC over CRC32C_LANE zero bytes
+static int initialized = 0;
+static int use_hardware = 0;
+
+static void init_table()
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++)
+        {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc_table[0][n] = crc;
+    }
+
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        for (int t = 1; t < 8; t++)
+        {
+            uint32_t prev = crc_table[t - 1][n];
+            crc_table[t][n] = (prev >> 8) ^ crc_table[0][prev & 0xFF];
+        }
+    }
+}
+
+static uint32_t crc32c_software(uint32_t crc, const uint8_t *p, size_t len)
+{
+    // Slice-by-8: fold eight bytes per step through eight tables.
+    while (len >= 8)
+    {
+        uint32_t low, high;
+        memcpy(&low, p, sizeof(low));
+        memcpy(&high, p + 4, sizeof(high));
+        low ^= crc;
+
+        crc = crc_table[7][low & 0xFF] ^ crc_table[6][(low >> 8) & 0xFF] ^
+              crc_table[5][(low >> 16) & 0xFF] ^ crc_table[4][low >> 24] ^
+              crc_table[3][high & 0xFF] ^ crc_table[2][(high >> 8) & 0xFF] ^
+              crc_table[1][(high >> 16) & 0xFF] ^ crc_table[0][high >> 24];
+
+        p += 8;
+        len -= 8;
+    }
+
+    while (len--)
+    {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xFF];
+    }
+    return crc;
+}
+
+/**
+ * Builds shift_table. Advancing a CRC over zero bytes is linear in the CRC,
+ * so the table for each byte lane is the XOR of the images of its bits.
+ */
+static void init_shift_table()
+{
+    static const uint8_t zeros[CRC32C_LANE];
+    uint32_t basis[32];
+
+    for (int bit = 0; bit < 32; bit++)
+    {
+        basis[bit] = crc32c_software(1u << bit, zeros, CRC32C_LANE);
+    }
+
+    for (int lane = 0; lane < 4; lane++)
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t value = 0;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                if (n & (1u << bit))
+                {
+                    value ^= basis[lane * 8 + bit];
+                }
+            }
+            shift_table[lane][n] = value;
+        }
+    }
+}
+
+static inline uint32_t shift_lane(uint32_t crc)
+{
+    return shift_table[0][crc & 0xFF] ^ shift_table[1][(crc >> 8) & 0xFF] ^
+           shift_table[2][(crc >> 16) & 0xFF] ^ shift_table[3][crc >> 24];
+}
+
+#ifdef CRC32C_HAVE_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint64_t crc64 = crc;
+
+    // The crc32 instruction has a latency of three cycles but issues every
+    // cycle, so three independent streams keep it busy. Their results are
+    // joined by advancing the earlier ones over the bytes that follow them.
+    while (len >= 3 * CRC32C_LANE)
+    {
+        uint64_t crc_b = 0;
+        uint64_t crc_c = 0;
+
+        for (size_t i = 0; i < CRC32C_LANE; i += 8)
+        {
+            uint64_t a, b, c;
+            memcpy(&a, p + i, sizeof(a));
+            memcpy(&b, p + CRC32C_LANE + i, sizeof(b));
+            memcpy(&c, p + 2 * CRC32C_LANE + i, sizeof(c));
+            crc64 = _mm_crc32_u64(crc64, a);
+            crc_b = _mm_crc32_u64(crc_b, b);
+            crc_c = _mm_crc32_u64(crc_c, c);
+        }
+
+        crc64 = shift_lane(shift_lane((uint32_t)crc64) ^ (uint32_t)crc_b) ^ (uint32_t)crc_c;
+        p += 3 * CRC32C_LANE;
+        len -= 3 * CRC32C_LANE;
+    }
+
+    while (len >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+
+    crc = (uint32_t)crc64;
+    while (len--)
+    {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+static void crc32c_init()
+{
+    init_table();
+    init_shift_table();
+#ifdef CRC32C_HAVE_SSE42
+    __builtin_cpu_init();
+    use_hardware = __builtin_cpu_supports("sse4.2") != 0;
+#endif
+    initialized = 1;
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len)
+{
+    if (!initialized)
+    {
+        crc32c_init();
+    }
+
+    crc = ~crc;
+#ifdef CRC32C_HAVE_SSE42
+    if (use_hardware)
+    {
+        return ~crc32c_sse42(crc, data, len);
+    }
+#endif
+    return ~crc32c_software(crc, data, len);
+}
+
+int crc32c_hardware()
+{
+    if (!initialized)
+    {
+        crc32c_init();
+    }
+    return use_hardware;
+}
@@ -1,39 +1,194 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "disk.h"
+#include "crc32c.h"
+#include "log.h"
 
-static FILE *disk;                      // disk file pointer
+#define INIT_CHUNK_BLOCKS 64             // blocks zeroed per write by disk_init()
+#define CHECKSUMS_PER_PAGE (BLOCK_SIZE / sizeof(uint32_t))  // checksums written back together
+
+static int disk = -1;                   // disk file descriptor
 static uint32_t number_of_blocks = 0;   // number of blocks in the disk
-static int reads = 0;                   // number of reads from the disk
-static int writes = 0;                  // number of writes to the disk
+static uint64_t reads = 0;              // number of reads from the disk
+static uint64_t writes = 0;             // number of writes to the disk
+static uint64_t discards = 0;           // number of blocks discarded
+
+static int direct_io = 0;               // 1 if the disk is open with O_DIRECT
+static void *bounce_block = NULL;       // aligned copy for unaligned buffers under O_DIRECT
+static uint64_t direct_bounces = 0;     // number of accesses that needed bounce_block
+
+static uint32_t *checksums = NULL;      // CRC32C of every block, indexed by block number
+static uint8_t *checksum_dirty = NULL;  // 1 for each table page changed since it was last written
+static uint32_t zero_checksum = 0;      // CRC32C of an all-zero block
+static int verify_checksums = 1;        // 1 if reads are checked against the table
+static uint64_t checksum_errors = 0;    // number of reads that failed verification
+static uint64_t checksum_ns = 0;        // time spent computing checksums
+
+static enum disk_tag current_tag = DISK_TAG_UNKNOWN;    // tag for the next accesses
+static struct disk_trace_entry *trace_ring = NULL;      // block trace ring buffer
+static uint32_t trace_mask = 0;                         // ring capacity - 1
+static uint64_t trace_head = 0;                         // number of entries ever recorded
+
+static const char *TAG_NAMES[DISK_TAG_COUNT] = {
+    "unknown",
+    "superblock",
+    "bitmap",
+    "inode",
+    "directory",
+    "data",
+    "indirect",
+    "refcount",
+};
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Returns the checksum of a block, adding the time it took to checksum_ns.
+ */
+static uint32_t block_checksum(const void *buf)
+{
+    uint64_t start = now_ns();
+    uint32_t crc = crc32c(0, buf, BLOCK_SIZE);
+    checksum_ns += now_ns() - start;
+    return crc;
+}
+
+/**
+ * Records the checksum of a block and marks its table page for writing back.
+ */
+static void set_checksum(uint32_t blocknum, uint32_t crc)
+{
+    checksums[blocknum] = crc;
+    checksum_dirty[blocknum / CHECKSUMS_PER_PAGE] = 1;
+}
+
+/**
+ * Writes the changed pages of the checksum table to the image, after the last
+ * block. The table is not a whole number of blocks, so the caller makes sure
+ * the disk is buffered.
+ */
+static int write_checksum_table()
+{
+    uint32_t pages = (number_of_blocks + CHECKSUMS_PER_PAGE - 1) / CHECKSUMS_PER_PAGE;
+    for (uint32_t page = 0; page < pages; page++)
+    {
+        if (!checksum_dirty[page])
+        {
+            continue;
+        }
+
+        uint32_t first = page * CHECKSUMS_PER_PAGE;
+        uint32_t count = number_of_blocks - first < CHECKSUMS_PER_PAGE ? number_of_blocks - first : CHECKSUMS_PER_PAGE;
+        size_t bytes = (size_t)count * sizeof(uint32_t);
+        off_t offset = (off_t)number_of_blocks * BLOCK_SIZE + (off_t)first * sizeof(uint32_t);
+        if (pwrite(disk, checksums + first, bytes, offset) != (ssize_t)bytes)
+        {
+            FS_LOG(FS_LOG_ERROR, "   ERROR: Could not write the checksum table.");
+            return -1;
+        }
+        checksum_dirty[page] = 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Appends an access to the trace ring, if tracing is on.
+ */
+static void trace_access(enum disk_trace_op op, uint32_t blocknum, uint32_t count)
+{
+    if (trace_ring == NULL)
+    {
+        return;
+    }
+
+    struct disk_trace_entry *entry = &trace_ring[trace_head & trace_mask];
+    entry->timestamp_ns = now_ns();
+    entry->blocknum = blocknum;
+    entry->op = op;
+    entry->tag = current_tag;
+    entry->count = count > UINT16_MAX ? UINT16_MAX : count;
+    trace_head++;
+}
 
 int disk_init(char *filename, int nblocks)
 {
-    // Open the file in write mode.
-    disk = fopen(filename, "w+");
+    // Open the file for reading and writing, discarding any previous contents.
+    disk = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
 
     // If the file could not be created, return -1.
-    if (disk == NULL)
+    if (disk < 0)
     {
         return -1;
     }
 
-    // Create a block of zeros.
-    char *block = calloc(BLOCK_SIZE, sizeof(char));
+    // Create a run of zero blocks, the checksum table and its dirty flags.
+    size_t table_pages = ((size_t)(nblocks > 0 ? nblocks : 1) + CHECKSUMS_PER_PAGE - 1) / CHECKSUMS_PER_PAGE;
+    char *block = calloc(INIT_CHUNK_BLOCKS, BLOCK_SIZE);
+    uint32_t *table = malloc((size_t)(nblocks > 0 ? nblocks : 1) * sizeof(uint32_t));
+    uint8_t *dirty = malloc(table_pages);
+
+    // If any could not be allocated, return -1.
+    if (block == NULL || table == NULL || dirty == NULL)
+    {
+        free(block);
+        free(table);
+        free(dirty);
+        close(disk);
+        disk = -1;
+        return -1;
+    }
 
-    // Write the blocks to the disk.
+    // Write the blocks to the disk; every block starts out zeroed.
+    zero_checksum = crc32c(0, block, BLOCK_SIZE);
+    for (int i = 0; i < nblocks; i += INIT_CHUNK_BLOCKS)
+    {
+        int count = nblocks - i < INIT_CHUNK_BLOCKS ? nblocks - i : INIT_CHUNK_BLOCKS;
+        if (pwrite(disk, block, (size_t)count * BLOCK_SIZE, (off_t)i * BLOCK_SIZE) != (ssize_t)count * BLOCK_SIZE)
+        {
+            free(block);
+            free(table);
+            free(dirty);
+            close(disk);
+            disk = -1;
+            return -1;
+        }
+    }
     for (int i = 0; i < nblocks; i++)
     {
-        fwrite(block, BLOCK_SIZE, 1, disk);
+        table[i] = zero_checksum;
     }
+    memset(dirty, 1, table_pages);
 
-    // Free the block.
+    // Free the blocks and replace any previous table.
     free(block);
+    free(checksums);
+    free(checksum_dirty);
+    checksums = table;
+    checksum_dirty = dirty;
 
-    // Set the number of blocks.
+    // Set the number of blocks; the disk starts out buffered.
     number_of_blocks = nblocks;
+    direct_io = 0;
+
+    // Store the initial table, so the image has one from the start.
+    if (write_checksum_table() < 0)
+    {
+        close(disk);
+        disk = -1;
+        return -1;
+    }
 
     // Return 0.
     return 0;
@@ -45,6 +200,21 @@ int disk_size()
     return number_of_blocks;
 }
 
+/**
+ * Returns the buffer to do I/O on for `buf`: `buf` itself, or the bounce block
+ * if the disk is in direct mode and `buf` is not aligned to a block.
+ */
+static void *direct_target(void *buf)
+{
+    if (!direct_io || ((uintptr_t)buf & (BLOCK_SIZE - 1)) == 0)
+    {
+        return buf;
+    }
+
+    direct_bounces++;
+    return bounce_block;
+}
+
 /**
  * Checks if the given block number and buffer are valid.
  * 
@@ -57,14 +227,13 @@ static int sanity_check(uint32_t blocknum, const void *buf)
 {
     if (blocknum >= number_of_blocks)
     {
-        printf("   > %d\n", blocknum);
-        printf("   ERROR: Block number must be less than %d.\n", number_of_blocks);
+        FS_LOG(FS_LOG_ERROR, "   ERROR: Block number %u must be less than %u.", blocknum, number_of_blocks);
         return -1;
     }
 
     if (buf == NULL)
     {
-        printf("   ERROR: Buffer cannot be NULL.\n");
+        FS_LOG(FS_LOG_ERROR, "   ERROR: Buffer cannot be NULL.");
         return -1;
     }
 
@@ -76,25 +245,35 @@ int disk_read(uint32_t blocknum, void *buf)
     // Perform sanity check.
     if (sanity_check(blocknum, buf) != 0)
     {
-        printf("   READ sanity check failed.\n");
+        FS_LOG(FS_LOG_ERROR, "   READ sanity check failed.");
         return -1;
     }
 
-    // Seek to the block.
-    fseek(disk, blocknum * BLOCK_SIZE, SEEK_SET);
+    // Direct I/O needs an aligned buffer; bounce through one if the caller's is not.
+    void *target = direct_target(buf);
 
     // Read the block.
-    int blocks_read = fread(buf, BLOCK_SIZE, 1, disk);
+    if (pread(disk, target, BLOCK_SIZE, (off_t)blocknum * BLOCK_SIZE) != BLOCK_SIZE)
+    {
+        FS_LOG(FS_LOG_ERROR, "   ERROR: Could not read block %u.", blocknum);
+        return -1;
+    }
+    if (target != buf)
+    {
+        memcpy(buf, target, BLOCK_SIZE);
+    }
 
-    // If the number of blocks read is not 1, return -1.
-    if (blocks_read != 1)
+    // Verify the block against its checksum.
+    if (verify_checksums && block_checksum(buf) != checksums[blocknum])
     {
-        printf("   ERROR: Could not read block %d.\n", blocknum);
+        checksum_errors++;
+        FS_LOG(FS_LOG_ERROR, "   ERROR: Checksum mismatch in block %u.", blocknum);
         return -1;
     }
 
     // Increment the number of reads.
     reads++;
+    trace_access(DISK_TRACE_READ, blocknum, 1);
 
     // Return the number of bytes read.
     return BLOCK_SIZE;
@@ -105,60 +284,304 @@ int disk_write(uint32_t blocknum, void *buf)
     // Perform sanity check.
     if (sanity_check(blocknum, buf) != 0)
     {
-        printf("   WRITE sanity check failed.\n");
+        FS_LOG(FS_LOG_ERROR, "   WRITE sanity check failed.");
         return -1;
     }
 
-    // Seek to the block.
-    fseek(disk, blocknum * BLOCK_SIZE, SEEK_SET);
+    // Direct I/O needs an aligned buffer; bounce through one if the caller's is not.
+    void *source = direct_target(buf);
+    if (source != buf)
+    {
+        memcpy(source, buf, BLOCK_SIZE);
+    }
 
     // Write the block.
-    int blocks_written = fwrite(buf, BLOCK_SIZE, 1, disk);
-
-    // If the number of blocks written is not 1, return -1.
-    if (blocks_written != 1)
+    if (pwrite(disk, source, BLOCK_SIZE, (off_t)blocknum * BLOCK_SIZE) != BLOCK_SIZE)
     {
-        printf("   ERROR: Could not write block %d.\n", blocknum);
+        FS_LOG(FS_LOG_ERROR, "   ERROR: Could not write block %u.", blocknum);
         return -1;
     }
 
+    // Record the checksum of the new contents.
+    set_checksum(blocknum, block_checksum(buf));
+
     // Increment the number of writes.
     writes++;
+    trace_access(DISK_TRACE_WRITE, blocknum, 1);
 
     // Return the number of bytes written.
     return BLOCK_SIZE;
 }
 
+int disk_discard(uint32_t blocknum, uint32_t count)
+{
+    // Validate the whole range.
+    if (disk < 0 || count == 0 || blocknum >= number_of_blocks || count > number_of_blocks - blocknum)
+    {
+        return -1;
+    }
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+    // Release the range to the host, keeping the image size unchanged.
+    if (fallocate(disk, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  (off_t)blocknum * BLOCK_SIZE, (off_t)count * BLOCK_SIZE) != 0)
+    {
+        return -1;
+    }
+
+    // The range reads back as zeros now.
+    for (uint32_t i = 0; i < count; i++)
+    {
+        set_checksum(blocknum + i, zero_checksum);
+    }
+
+    // Increment the number of discarded blocks.
+    discards += count;
+    trace_access(DISK_TRACE_DISCARD, blocknum, count);
+
+    // Return 0.
+    return 0;
+#else
+    // Hole punching is not available on this platform.
+    return -1;
+#endif
+}
+
+void disk_get_stats(struct disk_stats *stats)
+{
+    // Copy the counters.
+    stats->reads = reads;
+    stats->writes = writes;
+    stats->bytes_read = reads * BLOCK_SIZE;
+    stats->bytes_written = writes * BLOCK_SIZE;
+    stats->discarded_blocks = discards;
+    stats->checksum_errors = checksum_errors;
+    stats->checksum_ns = checksum_ns;
+    stats->direct_bounces = direct_bounces;
+}
+
+void disk_reset_stats()
+{
+    // Clear the counters.
+    reads = 0;
+    writes = 0;
+    discards = 0;
+    checksum_errors = 0;
+    checksum_ns = 0;
+    direct_bounces = 0;
+}
+
+void disk_set_verify(int enable)
+{
+    verify_checksums = enable != 0;
+}
+
+int disk_set_direct(int enable)
+{
+    // Direct I/O can only be switched on an open disk.
+    if (disk < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "   ERROR: Disk is not open.");
+        return -1;
+    }
+
+    // Allocate the bounce buffer the first time direct I/O is turned on.
+    if (enable && bounce_block == NULL)
+    {
+        bounce_block = aligned_alloc(BLOCK_SIZE, BLOCK_SIZE);
+        if (bounce_block == NULL)
+        {
+            return -1;
+        }
+    }
+
+    // Set or clear O_DIRECT; the host file system may refuse it.
+    int flags = fcntl(disk, F_GETFL);
+    if (flags < 0 || fcntl(disk, F_SETFL, enable ? flags | O_DIRECT : flags & ~O_DIRECT) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "   ERROR: Could not %s direct I/O.", enable ? "enable" : "disable");
+        return -1;
+    }
+
+    direct_io = enable != 0;
+
+    // Return 0.
+    return 0;
+}
+
+void disk_set_tag(enum disk_tag tag)
+{
+    current_tag = tag;
+}
+
+const char *disk_tag_name(enum disk_tag tag)
+{
+    return tag < DISK_TAG_COUNT ? TAG_NAMES[tag] : "invalid";
+}
+
+int disk_trace_enable(uint32_t capacity)
+{
+    // Round the capacity up to a power of two.
+    uint32_t size = 1;
+    while (size < capacity && size < (1u << 30))
+    {
+        size <<= 1;
+    }
+
+    struct disk_trace_entry *ring = calloc(size, sizeof(struct disk_trace_entry));
+    if (ring == NULL)
+    {
+        return -1;
+    }
+
+    // Replace any previous trace.
+    free(trace_ring);
+    trace_ring = ring;
+    trace_mask = size - 1;
+    trace_head = 0;
+
+    // Return 0.
+    return 0;
+}
+
+void disk_trace_disable()
+{
+    free(trace_ring);
+    trace_ring = NULL;
+    trace_mask = 0;
+    trace_head = 0;
+}
+
+int disk_trace_dump(const char *filename)
+{
+    // Nothing to dump if tracing is off.
+    if (trace_ring == NULL)
+    {
+        return -1;
+    }
+
+    FILE *out = fopen(filename, "wb");
+    if (out == NULL)
+    {
+        return -1;
+    }
+
+    // The ring holds the newest `kept` entries.
+    uint64_t capacity = (uint64_t)trace_mask + 1;
+    uint64_t kept = trace_head < capacity ? trace_head : capacity;
+
+    struct disk_trace_header header = {
+        .magic = DISK_TRACE_MAGIC,
+        .version = DISK_TRACE_VERSION,
+        .disk_blocks = number_of_blocks,
+        .entries = (uint32_t)kept,
+        .dropped = trace_head - kept,
+    };
+
+    int result = fwrite(&header, sizeof(header), 1, out) == 1 ? 0 : -1;
+
+    // Write oldest first: the part after the head, then the part before it.
+    uint64_t start = (trace_head - kept) & trace_mask;
+    uint64_t first = capacity - start < kept ? capacity - start : kept;
+
+    if (result == 0 && fwrite(&trace_ring[start], sizeof(struct disk_trace_entry), first, out) != first)
+    {
+        result = -1;
+    }
+    if (result == 0 && kept > first &&
+        fwrite(trace_ring, sizeof(struct disk_trace_entry), kept - first, out) != kept - first)
+    {
+        result = -1;
+    }
+
+    if (fclose(out) != 0)
+    {
+        result = -1;
+    }
+
+    // Return the result.
+    return result;
+}
+
+int disk_sync()
+{
+    // If the disk is not open, return -1.
+    if (disk < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "   ERROR: Disk is not open.");
+        return -1;
+    }
+
+    // The checksum table is written buffered; direct I/O is restored afterwards.
+    int was_direct = direct_io;
+    if (was_direct && disk_set_direct(0) < 0)
+    {
+        return -1;
+    }
+
+    int result = write_checksum_table();
+
+    if (was_direct && disk_set_direct(1) < 0)
+    {
+        result = -1;
+    }
+
+    // Return the result.
+    return result;
+}
+
 /**
  * @param log: 0 if log is not required, 1 if log is required
  */
 int disk_close(int log)
 {
     // If the disk is not open, return -1.
-    if (disk == NULL)
+    if (disk < 0)
     {
-        printf("   ERROR: Disk is not open.\n");
+        FS_LOG(FS_LOG_ERROR, "   ERROR: Disk is not open.");
         return -1;
     }
 
-    // If the disk could not be flushed, return -1.
-    else if (fclose(disk) != 0)
+    // The checksum table is not a whole number of blocks, so it is written buffered.
+    int result = 0;
+    if (direct_io && disk_set_direct(0) < 0)
+    {
+        result = -1;
+    }
+
+    // Store the rest of the checksum table, so offline tools can verify the image.
+    if (write_checksum_table() < 0)
     {
-        printf("   ERROR: Could not close disk.\n");
+        result = -1;
+    }
+
+    free(checksums);
+    checksums = NULL;
+    free(checksum_dirty);
+    checksum_dirty = NULL;
+
+    free(bounce_block);
+    bounce_block = NULL;
+
+    // If the disk could not be closed, return -1.
+    if (close(disk) != 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "   ERROR: Could not close disk.");
+        disk = -1;
         return -1;
     }
 
     // Print the number of reads and writes.
     if (log) 
     {
-        printf("   Reads (Blocks): %d\n", reads);
-        printf("   Writes (Blocks): %d\n", writes);
+        printf("   Reads (Blocks): %llu\n", (unsigned long long)reads);
+        printf("   Writes (Blocks): %llu\n", (unsigned long long)writes);
         printf("   Disk closed.\n");
     }
 
-    // Clear the disk pointer.
-    disk = NULL;
+    // Clear the disk descriptor.
+    disk = -1;
 
-    // Return 0.
-    return 0;
+    // Return the result.
+    return result;
 }
\ No newline at end of file
@@ -5,31 +5,278 @@
 #include <stdio.h>
 #include "fs.h"
 #include "disk.h"
+#include "stats.h"
+#include "log.h"
+#include "trace.h"
+#include "hash.h"
+#include "lz.h"
+#include "slab.h"
 
 static int MOUNT_FLAG = 0;
 static union block SUPERBLOCK;
 static union block BLOCK_BITMAP;
 static int DISK_OPEN_FLAG = 0;
+static int DISCARD_FLAG = 0;
+static int READONLY_FLAG = 0;
+static int DEDUP_FLAG = 0;
 static union block INODE_BITMAP;
+static union block UNWRITTEN_BITMAP;
 static struct inode *INODE_TABLE;
 #define ROOT_DIR_INODE 0
 
+#define CACHE_LINE_SIZE 64
+
+/*
+ * The fields that path walks, usage accounting and attribute scans read,
+ * split from the block pointers in INODE_TABLE so that those passes touch 16
+ * bytes per inode, four to a cache line. While mounted, size, is_directory
+ * and flags are kept here rather than in INODE_TABLE, and are copied back
+ * into the on-disk inodes when the table is stored.
+ *
+ * For a directory, file_count is the number of regular files below it and
+ * entries is the number of used entries in its blocks. Both are maintained
+ * incrementally on create/write/remove, like its byte total in INODE_INFO.
+ */
+struct inode_hot
+{
+    uint32_t size;
+    uint32_t parent;
+    uint32_t file_count;
+    uint16_t entries;
+    uint8_t is_directory;
+    uint8_t flags;
+};
+
+_Static_assert(sizeof(struct inode_hot) * 4 == CACHE_LINE_SIZE, "struct inode_hot must pack four to a cache line");
+
+static struct inode_hot *INODE_HOT;
+
+/*
+ * Directory bookkeeping. usage_bytes is the aggregate usage of the subtree
+ * (one block for the directory itself plus the sizes of all children); it is
+ * 64-bit because clones and sparse files count their full logical sizes, and
+ * is kept apart from the directory's own size. When inserting, block_entries
+ * counts the used entries in each directory block, and every slot before
+ * free_hint is known to be in use. Slots are numbered across the directory's
+ * blocks, DIRENTS_PER_BLOCK per block.
+ */
+#define DIR_SLOTS (INODE_DIRECT_POINTERS * DIRENTS_PER_BLOCK)
+
+struct inode_info
+{
+    uint64_t usage_bytes;
+    uint16_t free_hint;
+    uint8_t block_entries[INODE_DIRECT_POINTERS];
+};
+
+static struct inode_info *INODE_INFO;
+
+/*
+ * INODE_HOT, INODE_TABLE and INODE_INFO are carved from one allocation
+ * aligned to a cache line, so that each 64-byte inode fills exactly one line.
+ */
+static void *INODE_ARENA;
+
+/*
+ * Directory handles come from the FS_SLAB_DIR_HANDLE slab and the block each
+ * one caches from FS_SLAB_BLOCK, so opendir and closedir never call malloc.
+ */
+struct fs_dir
+{
+    uint32_t inode_index;
+    uint32_t block_index;
+    uint32_t slot;
+    uint32_t cached_block_num;
+    union block *cached_block;
+};
+
+/*
+ * Per-block reference counts, used once snapshots share blocks with the live
+ * filesystem. REFCOUNTS[b] is the number of references to block b beyond the
+ * first, so 0 means the block has a single owner and may be modified in place.
+ * Only the pointers in inodes and indirect blocks hold references: a shared
+ * indirect block holds one reference to each block it lists, however many
+ * owners it has itself.
+ */
+static uint16_t *REFCOUNTS;
+#define REFCOUNT_MAX UINT16_MAX
+#define REFCOUNTS_PER_BLOCK (BLOCK_SIZE / sizeof(uint16_t))
+
 #define BITMAP_SET(bitmap, index) (bitmap[(index) / 32] |= (1 << ((index) % 32)))
 #define BITMAP_CLEAR(bitmap, index) (bitmap[(index) / 32] &= ~(1 << ((index) % 32)))
 #define BITMAP_TEST(bitmap, index) (bitmap[(index) / 32] & (1 << ((index) % 32)))
 
+/*
+ * All block I/O goes through these so the disk layer's trace can attribute
+ * each access to the structure it belongs to.
+ */
+static int read_block(enum disk_tag tag, uint32_t block_num, void *buf)
+{
+    disk_set_tag(tag);
+    return disk_read(block_num, buf);
+}
+
+static int write_block(enum disk_tag tag, uint32_t block_num, void *buf)
+{
+    disk_set_tag(tag);
+    return disk_write(block_num, buf);
+}
+
+/*
+ * Cache of indirect blocks, keyed by physical block number. Without it a
+ * sequential read past the direct pointers re-reads the indirect block for
+ * every data block. Entries are updated in place by the writers below, so the
+ * cache is write-through, and dropped when their block is released.
+ */
+#define BMAP_CACHE_SIZE 16
+
+struct bmap_cache_entry
+{
+    uint32_t block_num;
+    uint64_t last_used;
+};
+
+// The blocks are kept apart from their keys so that each entry is not padded to a block.
+static struct bmap_cache_entry BMAP_CACHE[BMAP_CACHE_SIZE];
+static union block BMAP_BLOCKS[BMAP_CACHE_SIZE];
+static uint64_t bmap_clock = 0;
+
+/**
+ * Returns the cached contents of indirect block `block_num`, reading it on a
+ * miss. For a block that was just allocated, pass fresh = 1 to start from
+ * zeros without reading stale disk contents. The pointer stays valid until
+ * the next call.
+ *
+ * @return The cached block, or NULL on I/O error.
+ */
+static union block *get_indirect_block(uint32_t block_num, int fresh)
+{
+    int victim = 0;
+
+    for (int i = 0; i < BMAP_CACHE_SIZE; i++)
+    {
+        if (BMAP_CACHE[i].block_num == block_num)
+        {
+            stats_record_cache(FS_CACHE_BMAP, 1);
+            BMAP_CACHE[i].last_used = ++bmap_clock;
+            if (fresh)
+                memset(&BMAP_BLOCKS[i], 0, sizeof(union block));
+            return &BMAP_BLOCKS[i];
+        }
+
+        if (BMAP_CACHE[i].last_used < BMAP_CACHE[victim].last_used)
+            victim = i;
+    }
+
+    stats_record_cache(FS_CACHE_BMAP, 0);
+    BMAP_CACHE[victim].block_num = 0;
+
+    if (fresh)
+    {
+        memset(&BMAP_BLOCKS[victim], 0, sizeof(union block));
+    }
+    else if (read_block(DISK_TAG_INDIRECT, block_num, &BMAP_BLOCKS[victim]) < 0)
+    {
+        return NULL;
+    }
+
+    BMAP_CACHE[victim].block_num = block_num;
+    BMAP_CACHE[victim].last_used = ++bmap_clock;
+    return &BMAP_BLOCKS[victim];
+}
+
+static void invalidate_indirect_block(uint32_t block_num)
+{
+    for (int i = 0; i < BMAP_CACHE_SIZE; i++)
+    {
+        if (BMAP_CACHE[i].block_num == block_num)
+        {
+            BMAP_CACHE[i].block_num = 0;
+            BMAP_CACHE[i].last_used = 0;
+        }
+    }
+}
+
+/*
+ * The most recently decompressed cluster, keyed by the first block it is
+ * stored in. Compressed clusters are always rewritten to new blocks, so the
+ * key only goes stale when that block is released.
+ */
+static uint8_t CLUSTER_CACHE[FS_CLUSTER_SIZE];
+static uint32_t cluster_cache_block = 0;
+
+/*
+ * Fingerprint index for deduplication: a direct-mapped table from the XXH64
+ * hash of a block's contents to a block holding them. It is only a hint, so
+ * colliding entries simply replace each other and every match is compared
+ * byte for byte before it is used. BLOCK_FINGERPRINTS remembers the hash each
+ * block was indexed under so the entry can be dropped when the block is freed
+ * or overwritten. The index lives in memory and covers blocks written since
+ * mount.
+ */
+struct dedup_entry
+{
+    uint64_t hash;
+    uint32_t block_num;
+};
+
+static struct dedup_entry *DEDUP_INDEX;
+static uint64_t *BLOCK_FINGERPRINTS;
+static uint32_t dedup_mask = 0;
+
+static void dedup_forget(uint32_t block_num)
+{
+    if (!DEDUP_INDEX || BLOCK_FINGERPRINTS[block_num] == 0)
+        return;
+
+    struct dedup_entry *entry = &DEDUP_INDEX[BLOCK_FINGERPRINTS[block_num] & dedup_mask];
+    if (entry->block_num == block_num)
+        memset(entry, 0, sizeof(*entry));
+    BLOCK_FINGERPRINTS[block_num] = 0;
+}
+
+static void free_dedup_index()
+{
+    free(DEDUP_INDEX);
+    free(BLOCK_FINGERPRINTS);
+    DEDUP_INDEX = NULL;
+    BLOCK_FINGERPRINTS = NULL;
+    dedup_mask = 0;
+}
+
+#define FREE_BATCH_SIZE 256
+
+static uint32_t PENDING_FREES[FREE_BATCH_SIZE];
+static uint32_t pending_free_count = 0;
+
+static int block_is_shared(uint32_t block_num)
+{
+    return REFCOUNTS[block_num] != 0;
+}
+
+/**
+ * Returns whether a file block pointer references a physical block. Slots of
+ * a compressed cluster past its last stored block hold FS_PTR_COMPRESSED.
+ */
+static int holds_block(uint32_t pointer)
+{
+    return pointer != 0 && pointer != FS_PTR_COMPRESSED;
+}
+
 int fs_format()
 {
     if (MOUNT_FLAG)
     {
-        printf("Error: Disk is mounted. Unmount before formatting.\n");
+        FS_LOG(FS_LOG_ERROR, "Error: Disk is mounted. Unmount before formatting.");
         return -1;
     }
 
+    memset(&SUPERBLOCK, 0, sizeof(SUPERBLOCK));
+
     uint32_t total_blocks = disk_size();
     if (total_blocks < 8)
     {
-        printf("Error: Disk size too small for formatting.\n");
+        FS_LOG(FS_LOG_ERROR, "Error: Disk size too small for formatting.");
         return -1;
     }
 
@@ -46,17 +293,19 @@ int fs_format()
     SUPERBLOCK.superblock.s_blocks_count = total_blocks;
     SUPERBLOCK.superblock.s_block_bitmap = 1;
     SUPERBLOCK.superblock.s_inode_bitmap = 2;
-    SUPERBLOCK.superblock.s_inode_table_block_start = 3;
-    SUPERBLOCK.superblock.s_data_blocks_start = 3 + inode_blocks;
+    SUPERBLOCK.superblock.s_unwritten_bitmap = 3;
+    SUPERBLOCK.superblock.s_inode_table_block_start = 4;
+    SUPERBLOCK.superblock.s_data_blocks_start = 4 + inode_blocks;
 
     if (SUPERBLOCK.superblock.s_data_blocks_start >= total_blocks)
     {
-        printf("Error: Not enough space for data blocks.\n");
+        FS_LOG(FS_LOG_ERROR, "Error: Not enough space for data blocks.");
         return -1;
     }
 
     memset(&BLOCK_BITMAP, 0, sizeof(BLOCK_BITMAP));
     memset(&INODE_BITMAP, 0, sizeof(INODE_BITMAP));
+    memset(&UNWRITTEN_BITMAP, 0, sizeof(UNWRITTEN_BITMAP));
 
     for (uint32_t i = 0; i < SUPERBLOCK.superblock.s_data_blocks_start; i++)
     {
@@ -81,9 +330,9 @@ int fs_format()
     strncpy(dir_entries[1].name, "..", MAX_NAME_LEN);
     dir_entries[1].name[MAX_NAME_LEN - 1] = '\0';
 
-    if (disk_write(SUPERBLOCK.superblock.s_data_blocks_start, &root_dir_block) < 0)
+    if (write_block(DISK_TAG_DIRECTORY, SUPERBLOCK.superblock.s_data_blocks_start, &root_dir_block) < 0)
     {
-        printf("Error: Failed to write root directory data block.\n");
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to write root directory data block.");
         return -1;
     }
 
@@ -112,619 +361,762 @@ int fs_format()
             inode_index++;
         }
 
-        if (disk_write(SUPERBLOCK.superblock.s_inode_table_block_start + i, &inode_block) < 0)
+        if (write_block(DISK_TAG_INODE, SUPERBLOCK.superblock.s_inode_table_block_start + i, &inode_block) < 0)
         {
-            printf("Error: Failed to write inode block %u.\n", i);
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to write inode block %u.", i);
             return -1;
         }
     }
 
-    if (disk_write(0, &SUPERBLOCK) < 0 ||
-        disk_write(1, &BLOCK_BITMAP) < 0 ||
-        disk_write(2, &INODE_BITMAP) < 0)
+    if (write_block(DISK_TAG_SUPERBLOCK, 0, &SUPERBLOCK) < 0 ||
+        write_block(DISK_TAG_BITMAP, 1, &BLOCK_BITMAP) < 0 ||
+        write_block(DISK_TAG_BITMAP, 2, &INODE_BITMAP) < 0 ||
+        write_block(DISK_TAG_BITMAP, 3, &UNWRITTEN_BITMAP) < 0)
     {
-        printf("Error: Failed to write filesystem metadata.\n");
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to write filesystem metadata.");
         return -1;
     }
 
-    printf("Filesystem formatted successfully.\n");
+    FS_LOG(FS_LOG_INFO, "Filesystem formatted successfully.");
     return 0;
 }
 
-uint32_t allocate_data_block()
+static int compare_block_numbers(const void *a, const void *b)
 {
-    uint32_t total_blocks = SUPERBLOCK.superblock.s_blocks_count;
-    for (uint32_t i = SUPERBLOCK.superblock.s_data_blocks_start; i < total_blocks; i++)
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Applies the queued block frees to the bitmaps. The queue is sorted first so
+ * that adjacent blocks are released, and optionally discarded on the backing
+ * image, as one run, and so that the bits falling into one bitmap word are
+ * cleared with a single mask.
+ */
+static void flush_pending_frees()
+{
+    if (pending_free_count == 0)
+        return;
+
+    qsort(PENDING_FREES, pending_free_count, sizeof(uint32_t), compare_block_numbers);
+
+    uint32_t run_start = PENDING_FREES[0];
+    uint32_t run_length = 0;
+    uint32_t word = PENDING_FREES[0] / 32;
+    uint32_t mask = 0;
+
+    disk_set_tag(DISK_TAG_DATA);
+
+    for (uint32_t i = 0; i < pending_free_count; i++)
     {
-        if (!BITMAP_TEST(BLOCK_BITMAP.bitmap, i))
+        uint32_t block_num = PENDING_FREES[i];
+
+        if (block_num / 32 != word)
         {
-            BITMAP_SET(BLOCK_BITMAP.bitmap, i);
-            return i;
+            BLOCK_BITMAP.bitmap[word] &= ~mask;
+            UNWRITTEN_BITMAP.bitmap[word] &= ~mask;
+            word = block_num / 32;
+            mask = 0;
+        }
+        mask |= 1u << (block_num % 32);
+
+        if (block_num == run_start + run_length)
+        {
+            run_length++;
+            continue;
         }
+
+        if (DISCARD_FLAG)
+            disk_discard(run_start, run_length);
+        run_start = block_num;
+        run_length = 1;
     }
-    return (uint32_t)-1;
+
+    BLOCK_BITMAP.bitmap[word] &= ~mask;
+    UNWRITTEN_BITMAP.bitmap[word] &= ~mask;
+
+    if (DISCARD_FLAG)
+        disk_discard(run_start, run_length);
+
+    pending_free_count = 0;
 }
 
-int fs_mount()
+/**
+ * Drops a reference to a data block. A shared block just loses one reference;
+ * the last one queues the block to be freed. The block stays marked in use
+ * until the queue is flushed, which happens when it fills up, when an
+ * allocation runs out of space, or on unmount.
+ */
+static void release_data_block(uint32_t block_num)
 {
-    if (MOUNT_FLAG)
+    if (block_is_shared(block_num))
     {
-        printf("Error: Filesystem already mounted.\n");
-        return -1;
+        REFCOUNTS[block_num]--;
+        return;
     }
 
-    if (disk_read(0, &SUPERBLOCK) < 0 ||
-        disk_read(1, &BLOCK_BITMAP) < 0 ||
-        disk_read(2, &INODE_BITMAP) < 0)
+    invalidate_indirect_block(block_num);
+    dedup_forget(block_num);
+    if (cluster_cache_block == block_num)
+        cluster_cache_block = 0;
+
+    if (pending_free_count == FREE_BATCH_SIZE)
+        flush_pending_frees();
+
+    PENDING_FREES[pending_free_count++] = block_num;
+}
+
+/**
+ * Releases a file's indirect block together with the blocks it lists.
+ */
+static int release_indirect_block(struct inode *file_inode)
+{
+    if (file_inode->i_indirect_pointer == 0)
+        return 0;
+
+    // Another owner still needs the blocks a shared indirect block lists.
+    if (block_is_shared(file_inode->i_indirect_pointer))
     {
-        printf("Error: Failed to read filesystem metadata.\n");
-        return -1;
+        release_data_block(file_inode->i_indirect_pointer);
+        file_inode->i_indirect_pointer = 0;
+        return 0;
     }
 
-    uint32_t inode_table_blocks = SUPERBLOCK.superblock.s_data_blocks_start -
-                                  SUPERBLOCK.superblock.s_inode_table_block_start;
-    uint32_t inodes_per_block = BLOCK_SIZE / sizeof(struct inode);
-    uint32_t total_inodes = inodes_per_block * inode_table_blocks;
-
-    INODE_TABLE = malloc(total_inodes * sizeof(struct inode));
-    if (!INODE_TABLE)
+    union block indirect_block;
+    union block *cached = get_indirect_block(file_inode->i_indirect_pointer, 0);
+    if (!cached)
     {
-        printf("Error: Failed to allocate memory for inode table.\n");
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to read indirect block.");
         return -1;
     }
+    indirect_block = *cached;
 
-    uint32_t inode_index = 0;
-    union block inode_block;
-
-    for (uint32_t i = 0; i < inode_table_blocks; i++)
+    for (unsigned int i = 0; i < MAX_POINTERS; i++)
     {
-        if (disk_read(SUPERBLOCK.superblock.s_inode_table_block_start + i, &inode_block) < 0)
-        {
-            printf("Error: Failed to load inode table from disk.\n");
-            free(INODE_TABLE);
-            return -1;
-        }
-
-        for (uint32_t j = 0; j < inodes_per_block && inode_index < total_inodes; j++, inode_index++)
-        {
-            INODE_TABLE[inode_index] = inode_block.inodes[j];
-        }
+        if (holds_block(indirect_block.pointers[i]))
+            release_data_block(indirect_block.pointers[i]);
     }
 
-    MOUNT_FLAG = 1;
-    DISK_OPEN_FLAG = 1;
-    printf("Filesystem mounted successfully.\n");
+    release_data_block(file_inode->i_indirect_pointer);
+    file_inode->i_indirect_pointer = 0;
     return 0;
 }
 
-void fs_unmount()
+/**
+ * Releases every block referenced by a regular file: the direct blocks, the
+ * blocks listed in the indirect block and the indirect block itself.
+ */
+static int release_file_blocks(struct inode *file_inode)
 {
-    if (!MOUNT_FLAG)
+    for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
     {
-        printf("Error: Filesystem not mounted.\n");
-        return;
+        if (holds_block(file_inode->i_direct_pointers[dp]))
+            release_data_block(file_inode->i_direct_pointers[dp]);
+        file_inode->i_direct_pointers[dp] = 0;
     }
 
-    uint32_t inode_table_blocks = SUPERBLOCK.superblock.s_data_blocks_start -
-                                  SUPERBLOCK.superblock.s_inode_table_block_start;
-    uint32_t inodes_per_block = BLOCK_SIZE / sizeof(struct inode);
-    uint32_t total_inodes = inodes_per_block * inode_table_blocks;
-    uint32_t inode_index = 0;
-    union block inode_block;
+    return release_indirect_block(file_inode);
+}
 
-    for (uint32_t i = 0; i < inode_table_blocks; i++)
+uint32_t allocate_data_block()
+{
+    uint32_t total_blocks = SUPERBLOCK.superblock.s_blocks_count;
+    for (uint32_t i = SUPERBLOCK.superblock.s_data_blocks_start; i < total_blocks; i++)
     {
-
-        for (uint32_t j = 0; j < inodes_per_block && inode_index < total_inodes; j++, inode_index++)
+        if (!BITMAP_TEST(BLOCK_BITMAP.bitmap, i))
         {
-            inode_block.inodes[j] = INODE_TABLE[inode_index];
+            BITMAP_SET(BLOCK_BITMAP.bitmap, i);
+            return i;
         }
+    }
+
+    if (pending_free_count > 0)
+    {
+        flush_pending_frees();
+        return allocate_data_block();
+    }
+
+    return (uint32_t)-1;
+}
 
-        if (disk_write(SUPERBLOCK.superblock.s_inode_table_block_start + i, &inode_block) < 0)
+/**
+ * Writes `buf` to the block referenced by *slot. A block shared with a
+ * snapshot is left as it is: the data goes to a newly allocated block and
+ * *slot is redirected there.
+ */
+static int write_block_cow(enum disk_tag tag, uint32_t *slot, void *buf)
+{
+    if (block_is_shared(*slot))
+    {
+        uint32_t copy_block_num = allocate_data_block();
+        if (copy_block_num == (uint32_t)-1)
         {
-            printf("Error: Failed to write inode table to disk.\n");
+            FS_LOG(FS_LOG_ERROR, "Error: No available data blocks for copy-on-write.");
+            return -1;
         }
+
+        release_data_block(*slot);
+        *slot = copy_block_num;
     }
 
-    free(INODE_TABLE);
-    MOUNT_FLAG = 0;
-    printf("Filesystem unmounted successfully.\n");
+    return write_block(tag, *slot, buf);
 }
 
-int fs_create(const char *path, int is_directory)
+/**
+ * Gives `file_inode` a private copy of its indirect block if the current one
+ * is shared. The copy lists the same data blocks, so each of them gains a
+ * reference.
+ */
+static int unshare_indirect_block(struct inode *file_inode)
 {
-    if (!MOUNT_FLAG)
+    uint32_t shared_block_num = file_inode->i_indirect_pointer;
+    if (!block_is_shared(shared_block_num))
+        return 0;
+
+    union block *cached = get_indirect_block(shared_block_num, 0);
+    if (!cached)
     {
-        printf("Error: Filesystem not mounted.\n");
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to read indirect block.");
         return -1;
     }
+    union block indirect_block = *cached;
 
-    if (!path || path[0] != '/')
+    for (unsigned int i = 0; i < MAX_POINTERS; i++)
     {
-        printf("Error: Path must be absolute.\n");
-        return -1;
+        if (holds_block(indirect_block.pointers[i]) && REFCOUNTS[indirect_block.pointers[i]] == REFCOUNT_MAX)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Block reference count overflow.");
+            return -1;
+        }
     }
 
-    char path_copy[256];
-    strncpy(path_copy, path, sizeof(path_copy));
-    path_copy[sizeof(path_copy) - 1] = '\0';
+    uint32_t copy_block_num = allocate_data_block();
+    if (copy_block_num == (uint32_t)-1)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: No available data blocks for copy-on-write.");
+        return -1;
+    }
 
-    char *token;
-    char *rest = path_copy;
-    uint32_t parent_inode_index = ROOT_DIR_INODE;
-    uint32_t inode_index;
-    char name[MAX_NAME_LEN];
+    if (write_block(DISK_TAG_INDIRECT, copy_block_num, &indirect_block) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to write indirect block.");
+        release_data_block(copy_block_num);
+        return -1;
+    }
 
-    while ((token = strtok_r(rest, "/", &rest)))
+    for (unsigned int i = 0; i < MAX_POINTERS; i++)
     {
-        strncpy(name, token, MAX_NAME_LEN);
-        name[MAX_NAME_LEN - 1] = '\0';
+        if (holds_block(indirect_block.pointers[i]))
+            REFCOUNTS[indirect_block.pointers[i]]++;
+    }
 
-        int is_last_component = (rest == NULL || *rest == '\0');
-        int found = 0;
-        struct inode *parent_inode = &INODE_TABLE[parent_inode_index];
+    *get_indirect_block(copy_block_num, 1) = indirect_block;
+    release_data_block(shared_block_num);
+    file_inode->i_indirect_pointer = copy_block_num;
+    return 0;
+}
 
-        if (!parent_inode->i_is_directory)
-        {
-            printf("Error: Parent is not a directory.\n");
-            return -1;
-        }
+/**
+ * Allocates up to `count` physically contiguous data blocks.
+ *
+ * The search starts at `goal` so that a file keeps growing in place, then wraps
+ * around to the start of the data region. If no run of the full length exists,
+ * the longest free run found is allocated instead.
+ *
+ * @return The number of blocks allocated starting at *start, or 0 if the disk is full.
+ */
+static uint32_t allocate_block_run(uint32_t goal, uint32_t count, uint32_t *start)
+{
+    uint32_t data_start = SUPERBLOCK.superblock.s_data_blocks_start;
+    uint32_t total_blocks = SUPERBLOCK.superblock.s_blocks_count;
+    uint32_t best_start = 0;
+    uint32_t best_len = 0;
 
-        union block data_block;
-        for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+    if (goal < data_start || goal >= total_blocks)
+        goal = data_start;
+
+    for (int pass = 0; pass < 2 && best_len < count; pass++)
+    {
+        uint32_t i = pass == 0 ? goal : data_start;
+        uint32_t end = pass == 0 ? total_blocks : goal;
+
+        while (i < end && best_len < count)
         {
-            if (parent_inode->i_direct_pointers[dp] == 0)
+            if (i % 32 == 0 && BLOCK_BITMAP.bitmap[i / 32] == 0xFFFFFFFFu)
+            {
+                i += 32;
                 continue;
-
-            if (disk_read(parent_inode->i_direct_pointers[dp], &data_block) < 0)
+            }
+            if (BITMAP_TEST(BLOCK_BITMAP.bitmap, i))
             {
-                printf("Error: Failed to read directory data.\n");
-                return -1;
+                i++;
+                continue;
             }
 
-            struct directory_entry *entries = data_block.directory_entries;
-            for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
+            uint32_t run_start = i;
+            while (i < end && i - run_start < count && !BITMAP_TEST(BLOCK_BITMAP.bitmap, i))
+                i++;
+
+            if (i - run_start > best_len)
             {
-                entries[i].name[MAX_NAME_LEN - 1] = '\0';
-                if (entries[i].inode != 0 && strcmp(entries[i].name, name) == 0)
-                {
-                    inode_index = entries[i].inode;
-                    found = 1;
-                    break;
-                }
+                best_start = run_start;
+                best_len = i - run_start;
             }
-            if (found)
-                break;
         }
+    }
 
-        if (!found)
-        {
-            if (is_last_component || is_directory)
-            {
-                uint32_t total_inodes = SUPERBLOCK.superblock.s_inodes_count;
-                uint32_t new_inode_index = (uint32_t)-1;
-                for (uint32_t i = 0; i < total_inodes; i++)
-                {
-                    if (!BITMAP_TEST(INODE_BITMAP.bitmap, i))
-                    {
-                        new_inode_index = i;
-                        break;
-                    }
-                }
-                if (new_inode_index == (uint32_t)-1)
-                {
-                    printf("Error: No available inodes.\n");
-                    return -1;
-                }
+    if (best_len < count && pending_free_count > 0)
+    {
+        flush_pending_frees();
+        return allocate_block_run(goal, count, start);
+    }
 
-                BITMAP_SET(INODE_BITMAP.bitmap, new_inode_index);
-                struct inode *new_inode = &INODE_TABLE[new_inode_index];
-                memset(new_inode, 0, sizeof(struct inode));
-                new_inode->i_is_directory = is_last_component ? is_directory : 1;
+    for (uint32_t i = 0; i < best_len; i++)
+    {
+        BITMAP_SET(BLOCK_BITMAP.bitmap, best_start + i);
+    }
 
-                if (new_inode->i_is_directory)
-                {
-                    uint32_t total_blocks = SUPERBLOCK.superblock.s_blocks_count;
-                    uint32_t data_block_index = (uint32_t)-1;
-                    for (uint32_t i = SUPERBLOCK.superblock.s_data_blocks_start; i < total_blocks; i++)
-                    {
-                        if (!BITMAP_TEST(BLOCK_BITMAP.bitmap, i))
-                        {
-                            data_block_index = i;
-                            break;
-                        }
-                    }
-                    if (data_block_index == (uint32_t)-1)
-                    {
-                        printf("Error: No available data blocks.\n");
-                        return -1;
-                    }
+    *start = best_start;
+    return best_len;
+}
 
-                    BITMAP_SET(BLOCK_BITMAP.bitmap, data_block_index);
-                    union block new_data_block = {0};
-                    struct directory_entry *dir_entries = new_data_block.directory_entries;
+/**
+ * Allocates `count` contiguous blocks for filesystem metadata.
+ *
+ * @return The first block, or 0 if no run of that length is free.
+ */
+static uint32_t allocate_metadata_run(uint32_t count)
+{
+    uint32_t start;
+    uint32_t allocated = allocate_block_run(0, count, &start);
 
-                    dir_entries[0].inode = new_inode_index;
-                    strncpy(dir_entries[0].name, ".", MAX_NAME_LEN);
-                    dir_entries[0].name[MAX_NAME_LEN - 1] = '\0';
+    if (allocated == count)
+        return start;
 
-                    dir_entries[1].inode = parent_inode_index;
-                    strncpy(dir_entries[1].name, "..", MAX_NAME_LEN);
-                    dir_entries[1].name[MAX_NAME_LEN - 1] = '\0';
+    for (uint32_t i = 0; i < allocated; i++)
+    {
+        release_data_block(start + i);
+    }
+    return 0;
+}
 
-                    if (disk_write(data_block_index, &new_data_block) < 0)
-                    {
-                        printf("Error: Failed to write data block.\n");
-                        return -1;
-                    }
+/**
+ * Gives the volume an on-disk reference count table the first time blocks
+ * become shared.
+ */
+static int ensure_refcount_table()
+{
+    if (SUPERBLOCK.superblock.s_refcount_table_start != 0)
+        return 0;
 
-                    new_inode->i_direct_pointers[0] = data_block_index;
-                    new_inode->i_size = BLOCK_SIZE;
-                }
-                else
-                {
-                    new_inode->i_size = 0;
-                }
+    uint32_t table_blocks = (SUPERBLOCK.superblock.s_blocks_count + REFCOUNTS_PER_BLOCK - 1) / REFCOUNTS_PER_BLOCK;
+    uint32_t table_start = allocate_metadata_run(table_blocks);
+    if (table_start == 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: No space for the reference count table.");
+        return -1;
+    }
 
-                int entry_added = 0;
-                for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
-                {
-                    if (parent_inode->i_direct_pointers[dp] == 0)
-                    {
+    SUPERBLOCK.superblock.s_refcount_table_start = table_start;
+    SUPERBLOCK.superblock.s_refcount_table_blocks = table_blocks;
 
-                        uint32_t new_data_block_index = (uint32_t)-1;
-                        for (uint32_t i = SUPERBLOCK.superblock.s_data_blocks_start; i < SUPERBLOCK.superblock.s_blocks_count; i++)
-                        {
-                            if (!BITMAP_TEST(BLOCK_BITMAP.bitmap, i))
-                            {
-                                new_data_block_index = i;
-                                break;
-                            }
-                        }
-                        if (new_data_block_index == (uint32_t)-1)
-                        {
-                            printf("Error: No available data blocks.\n");
-                            return -1;
-                        }
-
-                        BITMAP_SET(BLOCK_BITMAP.bitmap, new_data_block_index);
-                        union block new_data_block = {0};
-                        parent_inode->i_direct_pointers[dp] = new_data_block_index;
-
-                        parent_inode->i_size += BLOCK_SIZE;
-
-                        struct directory_entry *entries = new_data_block.directory_entries;
-                        entries[0].inode = new_inode_index;
-                        strncpy(entries[0].name, name, MAX_NAME_LEN);
-                        entries[0].name[MAX_NAME_LEN - 1] = '\0';
-                        if (disk_write(new_data_block_index, &new_data_block) < 0)
-                        {
-                            printf("Error: Failed to write directory data.\n");
-                            return -1;
-                        }
-                        entry_added = 1;
-                        break;
-                    }
-                    else
-                    {
+    if (write_block(DISK_TAG_SUPERBLOCK, 0, &SUPERBLOCK) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to write superblock.");
+        return -1;
+    }
 
-                        if (disk_read(parent_inode->i_direct_pointers[dp], &data_block) < 0)
-                        {
-                            printf("Error: Failed to read directory data.\n");
-                            return -1;
-                        }
-
-                        struct directory_entry *entries = data_block.directory_entries;
-                        for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
-                        {
-                            if (entries[i].inode == 0)
-                            {
-                                entries[i].inode = new_inode_index;
-                                strncpy(entries[i].name, name, MAX_NAME_LEN);
-                                entries[i].name[MAX_NAME_LEN - 1] = '\0';
-                                if (disk_write(parent_inode->i_direct_pointers[dp], &data_block) < 0)
-                                {
-                                    printf("Error: Failed to write directory data.\n");
-                                    return -1;
-                                }
-                                entry_added = 1;
-                                break;
-                            }
-                        }
-                        if (entry_added)
-                            break;
-                    }
-                }
+    return 0;
+}
 
-                if (!entry_added)
-                {
-                    printf("Error: No space in directory.\n");
-                    return -1;
-                }
+static int block_is_zero(const union block *data_block)
+{
+    for (unsigned int i = 0; i < BLOCK_SIZE / sizeof(uint64_t); i++)
+    {
+        uint64_t word;
+        memcpy(&word, data_block->data + i * sizeof(uint64_t), sizeof(word));
+        if (word != 0)
+            return 0;
+    }
+    return 1;
+}
 
-                parent_inode_index = new_inode_index;
+/**
+ * Tries to store the new contents of the file block referenced by *slot
+ * without writing them: an all-zero block becomes a hole, and contents that
+ * already exist in another block are shared with it.
+ *
+ * @return 1 if *slot now references the contents, 0 if the block must be
+ * written (*hash is then set for dedup_remember()), -1 on error.
+ */
+static int dedup_block(uint32_t *slot, const union block *data_block, uint64_t *hash)
+{
+    if (block_is_zero(data_block))
+    {
+        if (*slot != 0)
+            release_data_block(*slot);
+        *slot = 0;
+        return 1;
+    }
 
-                if (is_last_component)
-                {
-                    printf("Creating %s: %s\n", is_directory ? "directory" : "file", path);
-                    return 0;
-                }
-            }
-            else
-            {
-                printf("Creating intermediate directory: %s\n", name);
-                char intermediate_path[256];
-                snprintf(intermediate_path, sizeof(intermediate_path), "/%s", name);
-                if (fs_create(intermediate_path, 1) == -1)
-                {
-                    printf("Error: Failed to create intermediate directory: %s\n", name);
-                    return -1;
-                }
-            }
-        }
-        else
+    if (!DEDUP_INDEX)
+    {
+        uint32_t index_size = 1;
+        while (index_size < SUPERBLOCK.superblock.s_blocks_count)
+            index_size <<= 1;
+
+        DEDUP_INDEX = calloc(index_size, sizeof(struct dedup_entry));
+        BLOCK_FINGERPRINTS = calloc(SUPERBLOCK.superblock.s_blocks_count, sizeof(uint64_t));
+        if (!DEDUP_INDEX || !BLOCK_FINGERPRINTS)
         {
-            if (is_last_component)
-            {
-                printf("Error: File or directory already exists.\n");
-                return -1;
-            }
-            parent_inode_index = inode_index;
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to allocate memory for the dedup index.");
+            free_dedup_index();
+            return -1;
         }
+        dedup_mask = index_size - 1;
     }
 
-    printf("Error: Cannot create root directory.\n");
-    return -1;
-}
+    // Zero is reserved for blocks that are not indexed.
+    *hash = hash_xxh64(data_block, BLOCK_SIZE, 0) | 1;
 
-int fs_remove(const char *path)
-{
-    if (!MOUNT_FLAG)
+    struct dedup_entry *entry = &DEDUP_INDEX[*hash & dedup_mask];
+    uint32_t candidate = entry->block_num;
+    int usable = entry->hash == *hash && candidate != 0 && candidate != *slot && REFCOUNTS[candidate] < REFCOUNT_MAX;
+
+    stats_record_cache(FS_CACHE_DEDUP, usable);
+    if (!usable)
+        return 0;
+
+    union block existing;
+    if (read_block(DISK_TAG_DATA, candidate, &existing) < 0)
     {
-        printf("Error: Filesystem not mounted.\n");
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to read data block.");
         return -1;
     }
 
-    if (!path || path[0] != '/')
-    {
-        printf("Error: Path must be absolute and start with '/'.\n");
+    if (memcmp(&existing, data_block, BLOCK_SIZE) != 0)
+        return 0;
+
+    if (ensure_refcount_table() < 0)
         return -1;
+
+    REFCOUNTS[candidate]++;
+    if (*slot != 0)
+        release_data_block(*slot);
+    *slot = candidate;
+    return 1;
+}
+
+static void dedup_remember(uint32_t block_num, uint64_t hash)
+{
+    struct dedup_entry *entry = &DEDUP_INDEX[hash & dedup_mask];
+
+    if (entry->block_num != 0)
+        BLOCK_FINGERPRINTS[entry->block_num] = 0;
+
+    entry->hash = hash;
+    entry->block_num = block_num;
+    BLOCK_FINGERPRINTS[block_num] = hash;
+}
+
+/**
+ * Applies a usage change to `dir_inode_index` and every directory above it.
+ */
+static void propagate_usage(uint32_t dir_inode_index, int64_t bytes_delta, int32_t files_delta)
+{
+    if (bytes_delta == 0 && files_delta == 0)
+        return;
+
+    for (;;)
+    {
+        INODE_INFO[dir_inode_index].usage_bytes += bytes_delta;
+        INODE_HOT[dir_inode_index].file_count += files_delta;
+
+        if (dir_inode_index == ROOT_DIR_INODE)
+            break;
+        dir_inode_index = INODE_HOT[dir_inode_index].parent;
     }
+}
 
-    char path_copy[256];
-    strncpy(path_copy, path, sizeof(path_copy));
-    path_copy[sizeof(path_copy) - 1] = '\0';
+/**
+ * Returns the bytes an inode accounts for: a file's size, or a directory's
+ * subtree total.
+ */
+static uint64_t usage_bytes(uint32_t inode_index)
+{
+    return INODE_HOT[inode_index].is_directory ? INODE_INFO[inode_index].usage_bytes : INODE_HOT[inode_index].size;
+}
 
-    char *token;
-    char *rest = path_copy;
-    uint32_t parent_inode_index = ROOT_DIR_INODE;
-    uint32_t target_inode_index = ROOT_DIR_INODE;
-    char name[MAX_NAME_LEN];
+/**
+ * Records that `slot` of directory `dir_inode_index` now holds an entry.
+ */
+static void dir_slot_used(uint32_t dir_inode_index, uint32_t slot)
+{
+    struct inode_info *info = &INODE_INFO[dir_inode_index];
+    struct inode *dir_inode = &INODE_TABLE[dir_inode_index];
 
-    while ((token = strtok_r(rest, "/", &rest)))
+    info->block_entries[slot / DIRENTS_PER_BLOCK]++;
+    INODE_HOT[dir_inode_index].entries++;
+
+    // Move past the slot if it was the hint, and past any blocks that are now full.
+    uint32_t hint = slot == info->free_hint ? slot + 1 : info->free_hint;
+    while (hint < DIR_SLOTS && dir_inode->i_direct_pointers[hint / DIRENTS_PER_BLOCK] != 0 &&
+           info->block_entries[hint / DIRENTS_PER_BLOCK] == DIRENTS_PER_BLOCK)
     {
-        strncpy(name, token, MAX_NAME_LEN);
-        name[MAX_NAME_LEN - 1] = '\0';
+        hint = (hint / DIRENTS_PER_BLOCK + 1) * DIRENTS_PER_BLOCK;
+    }
+    info->free_hint = hint;
+}
 
-        struct inode *parent_inode = &INODE_TABLE[parent_inode_index];
-        if (!parent_inode->i_is_directory)
-        {
-            printf("Error: '%s' is not a directory.\n", path);
-            return -1;
-        }
+/**
+ * Records that `slot` of directory `dir_inode_index` was emptied.
+ */
+static void dir_slot_freed(uint32_t dir_inode_index, uint32_t slot)
+{
+    struct inode_info *info = &INODE_INFO[dir_inode_index];
 
-        int found = 0;
-        for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
-        {
-            if (parent_inode->i_direct_pointers[dp] == 0)
-            {
-                continue;
-            }
+    info->block_entries[slot / DIRENTS_PER_BLOCK]--;
+    INODE_HOT[dir_inode_index].entries--;
+    if (slot < info->free_hint)
+        info->free_hint = slot;
+}
 
-            union block parent_data_block;
-            if (disk_read(parent_inode->i_direct_pointers[dp], &parent_data_block) < 0)
-            {
-                printf("Error: Failed to read directory data.\n");
-                return -1;
-            }
+/**
+ * Resets the hot fields and bookkeeping of a newly created inode. A new
+ * directory starts out using its one block, which holds "." and "..", and
+ * ".." reads as a free slot when the parent is the root, whose inode number
+ * is 0.
+ */
+static void init_inode_info(uint32_t inode_index, uint32_t parent_inode_index, int is_directory)
+{
+    struct inode_hot *hot = &INODE_HOT[inode_index];
+    struct inode_info *info = &INODE_INFO[inode_index];
 
-            struct directory_entry *entries = parent_data_block.directory_entries;
-            for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
-            {
-                entries[i].name[MAX_NAME_LEN - 1] = '\0';
-                if (entries[i].inode != 0 && strcmp(entries[i].name, name) == 0)
-                {
-                    target_inode_index = entries[i].inode;
-                    found = 1;
-                    break;
-                }
-            }
+    memset(hot, 0, sizeof(*hot));
+    memset(info, 0, sizeof(*info));
+    hot->parent = parent_inode_index;
+    hot->is_directory = is_directory != 0;
 
-            if (found)
-            {
-                break;
-            }
-        }
+    if (is_directory)
+    {
+        hot->size = BLOCK_SIZE;
+        info->usage_bytes = BLOCK_SIZE;
+        hot->entries = parent_inode_index == ROOT_DIR_INODE ? 1 : 2;
+        info->block_entries[0] = hot->entries;
+        info->free_hint = hot->entries;
+    }
+}
 
-        if (!found)
+/**
+ * Returns an inode to the free pool. Its on-disk fields, hot fields and
+ * bookkeeping are all cleared, so store_inode_table writes it back as zeros.
+ */
+static void free_inode(uint32_t inode_index)
+{
+    BITMAP_CLEAR(INODE_BITMAP.bitmap, inode_index);
+    memset(&INODE_TABLE[inode_index], 0, sizeof(struct inode));
+    memset(&INODE_HOT[inode_index], 0, sizeof(struct inode_hot));
+    memset(&INODE_INFO[inode_index], 0, sizeof(struct inode_info));
+}
+
+/**
+ * Picks the slot a new entry of directory `dir_inode_index` goes into, from
+ * its free slot hint, and leaves the slot's block in `data_block`. Pass
+ * loaded = 1 if `data_block` already holds the hinted block. An empty block
+ * pointer gets a newly allocated, zeroed block.
+ */
+static int claim_free_slot(uint32_t dir_inode_index, union block *data_block, int loaded, uint32_t *slot)
+{
+    uint32_t free_slot = INODE_INFO[dir_inode_index].free_hint;
+    if (free_slot >= DIR_SLOTS)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: No space in directory.");
+        return -1;
+    }
+
+    uint32_t *block_pointer = &INODE_TABLE[dir_inode_index].i_direct_pointers[free_slot / DIRENTS_PER_BLOCK];
+    unsigned int entry_index = free_slot % DIRENTS_PER_BLOCK;
+
+    if (*block_pointer == 0)
+    {
+        uint32_t new_data_block_index = allocate_data_block();
+        if (new_data_block_index == (uint32_t)-1)
         {
-            printf("Error: '%s' not found.\n", path);
+            FS_LOG(FS_LOG_ERROR, "Error: No available data blocks.");
             return -1;
         }
 
-        if (rest == NULL || *rest == '\0')
+        memset(data_block, 0, sizeof(union block));
+        *block_pointer = new_data_block_index;
+    }
+    else
+    {
+        if (!loaded && read_block(DISK_TAG_DIRECTORY, *block_pointer, data_block) < 0)
         {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to read directory data.");
+            return -1;
+        }
 
-            break;
+        while (entry_index < DIRENTS_PER_BLOCK && data_block->directory_entries[entry_index].inode != 0)
+        {
+            entry_index++;
         }
-        else
+        if (entry_index == DIRENTS_PER_BLOCK)
         {
-
-            parent_inode_index = target_inode_index;
+            FS_LOG(FS_LOG_ERROR, "Error: No space in directory.");
+            return -1;
         }
     }
 
-    struct inode *target_inode = &INODE_TABLE[target_inode_index];
+    *slot = free_slot - free_slot % DIRENTS_PER_BLOCK + entry_index;
+    return 0;
+}
+
+/**
+ * Rebuilds parent links, directory usage counters and entry counts with a
+ * single breadth-first pass over the tree, then folds the totals bottom-up.
+ */
+static int build_inode_info(uint32_t total_inodes)
+{
+    uint32_t *order = malloc(total_inodes * sizeof(uint32_t));
+    if (!order)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to allocate memory for inode info.");
+        return -1;
+    }
 
-    if (target_inode->i_is_directory)
+    uint32_t order_count = 0;
+    order[order_count++] = ROOT_DIR_INODE;
+    INODE_HOT[ROOT_DIR_INODE].size = BLOCK_SIZE;
+    INODE_INFO[ROOT_DIR_INODE].usage_bytes = BLOCK_SIZE;
+
+    for (uint32_t k = 0; k < order_count; k++)
     {
+        uint32_t dir_inode_index = order[k];
+        struct inode *dir_inode = &INODE_TABLE[dir_inode_index];
+        struct inode_info *dir_info = &INODE_INFO[dir_inode_index];
+
+        dir_info->free_hint = DIR_SLOTS;
 
         for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
         {
-            if (target_inode->i_direct_pointers[dp] == 0)
+            if (dir_inode->i_direct_pointers[dp] == 0)
             {
+                if (dir_info->free_hint == DIR_SLOTS)
+                    dir_info->free_hint = dp * DIRENTS_PER_BLOCK;
                 continue;
             }
 
             union block dir_data_block;
-            if (disk_read(target_inode->i_direct_pointers[dp], &dir_data_block) < 0)
+            if (read_block(DISK_TAG_DIRECTORY, dir_inode->i_direct_pointers[dp], &dir_data_block) < 0)
             {
-                printf("Error: Failed to read directory data.\n");
+                FS_LOG(FS_LOG_ERROR, "Error: Failed to read directory data.");
+                free(order);
                 return -1;
             }
 
             struct directory_entry *entries = dir_data_block.directory_entries;
             for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
             {
-                if (entries[i].inode != 0)
+                if (entries[i].inode == 0)
                 {
+                    if (dir_info->free_hint == DIR_SLOTS)
+                        dir_info->free_hint = dp * DIRENTS_PER_BLOCK + i;
+                    continue;
+                }
 
-                    if (strcmp(entries[i].name, ".") == 0 || strcmp(entries[i].name, "..") == 0)
-                    {
-                        continue;
-                    }
-
-                    char child_path[256];
-                    snprintf(child_path, sizeof(child_path), "%s/%s", path, entries[i].name);
+                dir_info->block_entries[dp]++;
+                INODE_HOT[dir_inode_index].entries++;
+                if (entries[i].inode >= total_inodes)
+                    continue;
 
-                    if (fs_remove(child_path) < 0)
-                    {
-                        printf("Error: Failed to remove '%s'.\n", child_path);
-                        return -1;
-                    }
-                }
-            }
+                entries[i].name[MAX_NAME_LEN - 1] = '\0';
+                if (strcmp(entries[i].name, ".") == 0 || strcmp(entries[i].name, "..") == 0)
+                    continue;
 
-            BITMAP_CLEAR(BLOCK_BITMAP.bitmap, target_inode->i_direct_pointers[dp]);
-            target_inode->i_direct_pointers[dp] = 0;
-        }
-    }
-    else
-    {
+                uint32_t child_inode_index = entries[i].inode;
+                struct inode_hot *child_hot = &INODE_HOT[child_inode_index];
+                child_hot->parent = dir_inode_index;
 
-        for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
-        {
-            if (target_inode->i_direct_pointers[dp] == 0)
-            {
-                continue;
+                if (child_hot->is_directory)
+                {
+                    child_hot->size = BLOCK_SIZE;
+                    INODE_INFO[child_inode_index].usage_bytes = BLOCK_SIZE;
+                    if (order_count < total_inodes)
+                        order[order_count++] = child_inode_index;
+                }
+                else
+                {
+                    dir_info->usage_bytes += child_hot->size;
+                    INODE_HOT[dir_inode_index].file_count++;
+                }
             }
-
-            BITMAP_CLEAR(BLOCK_BITMAP.bitmap, target_inode->i_direct_pointers[dp]);
-            target_inode->i_direct_pointers[dp] = 0;
         }
     }
 
-    BITMAP_CLEAR(INODE_BITMAP.bitmap, target_inode_index);
-    memset(target_inode, 0, sizeof(struct inode));
-
-    struct inode *parent_inode = &INODE_TABLE[parent_inode_index];
-    for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+    // Children always come after their parent in BFS order.
+    for (uint32_t k = order_count; k-- > 1;)
     {
-        if (parent_inode->i_direct_pointers[dp] == 0)
-        {
-            continue;
-        }
-
-        union block parent_data_block;
-        if (disk_read(parent_inode->i_direct_pointers[dp], &parent_data_block) < 0)
-        {
-            printf("Error: Failed to read parent directory data.\n");
-            return -1;
-        }
+        uint32_t dir_inode_index = order[k];
+        uint32_t parent_inode_index = INODE_HOT[dir_inode_index].parent;
 
-        struct directory_entry *entries = parent_data_block.directory_entries;
-        int entry_found = 0;
-        for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
-        {
-            if (entries[i].inode == target_inode_index)
-            {
-                memset(&entries[i], 0, sizeof(struct directory_entry));
-                entry_found = 1;
-                if (disk_write(parent_inode->i_direct_pointers[dp], &parent_data_block) < 0)
-                {
-                    printf("Error: Failed to update parent directory.\n");
-                    return -1;
-                }
-
-                parent_inode->i_size -= sizeof(struct directory_entry);
-                printf("Removed: %s\n", path);
-                return 0;
-            }
-        }
+        INODE_INFO[parent_inode_index].usage_bytes += INODE_INFO[dir_inode_index].usage_bytes;
+        INODE_HOT[parent_inode_index].file_count += INODE_HOT[dir_inode_index].file_count;
     }
 
-    printf("Error: Could not remove '%s'.\n", path);
-    return -1;
+    free(order);
+    return 0;
 }
 
-int calculate_directory_size(uint32_t inode_index)
+/**
+ * Looks up `name` in the directory `dir_inode`.
+ *
+ * @return 1 if found (and *inode_index is set), 0 if not found, -1 on I/O error.
+ */
+static int lookup_entry(struct inode *dir_inode, const char *name, uint32_t *inode_index)
 {
-    struct inode *dir_inode = &INODE_TABLE[inode_index];
+    union block data_block;
+    struct inode_info *dir_info = &INODE_INFO[dir_inode - INODE_TABLE];
 
-    if (!dir_inode->i_is_directory)
-    {
-        return dir_inode->i_size;
-    }
+    // The scan stops once every used entry has been seen.
+    uint32_t unseen = INODE_HOT[dir_inode - INODE_TABLE].entries;
 
-    int total_size = 0;
-
-    for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+    for (int dp = 0; dp < INODE_DIRECT_POINTERS && unseen > 0; dp++)
     {
-        if (dir_inode->i_direct_pointers[dp] == 0)
-        {
+        if (dir_inode->i_direct_pointers[dp] == 0 || dir_info->block_entries[dp] == 0)
             continue;
-        }
 
-        union block dir_data_block;
-        if (disk_read(dir_inode->i_direct_pointers[dp], &dir_data_block) < 0)
+        unseen -= dir_info->block_entries[dp];
+        if (read_block(DISK_TAG_DIRECTORY, dir_inode->i_direct_pointers[dp], &data_block) < 0)
         {
-            printf("Error: Failed to read directory data.\n");
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to read directory data.");
             return -1;
         }
 
-        struct directory_entry *dir_entries = dir_data_block.directory_entries;
-
+        struct directory_entry *entries = data_block.directory_entries;
         for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
         {
-            if (dir_entries[i].inode != 0)
+            entries[i].name[MAX_NAME_LEN - 1] = '\0';
+            if (entries[i].inode != 0 && strcmp(entries[i].name, name) == 0)
             {
-
-                if (strcmp(dir_entries[i].name, ".") == 0 || strcmp(dir_entries[i].name, "..") == 0)
-                {
-                    continue;
-                }
-
-                total_size += calculate_directory_size(dir_entries[i].inode);
+                *inode_index = entries[i].inode;
+                return 1;
             }
         }
     }
 
-    dir_inode->i_size = total_size + BLOCK_SIZE;
-    return dir_inode->i_size;
+    return 0;
 }
 
-int fs_list(const char *path)
+/**
+ * Resolves an absolute path to its inode index.
+ *
+ * @return 0 on success, -1 if a component is missing or not a directory.
+ */
+static int resolve_path(const char *path, uint32_t *inode_index)
 {
-    if (!MOUNT_FLAG)
-    {
-        return -1;
-    }
-
-    if (!path || path[0] != '/')
-    {
-        return -1;
-    }
-
+    uint64_t start = stats_now_ns();
     char path_copy[256];
     strncpy(path_copy, path, sizeof(path_copy));
     path_copy[sizeof(path_copy) - 1] = '\0';
@@ -732,7 +1124,6 @@ int fs_list(const char *path)
     char *token;
     char *rest = path_copy;
     uint32_t current_inode_index = ROOT_DIR_INODE;
-    uint32_t inode_index;
     char name[MAX_NAME_LEN];
 
     while ((token = strtok_r(rest, "/", &rest)))
@@ -740,116 +1131,476 @@ int fs_list(const char *path)
         strncpy(name, token, MAX_NAME_LEN);
         name[MAX_NAME_LEN - 1] = '\0';
 
-        struct inode *current_inode = &INODE_TABLE[current_inode_index];
-
-        if (!current_inode->i_is_directory)
+        if (!INODE_HOT[current_inode_index].is_directory ||
+            lookup_entry(&INODE_TABLE[current_inode_index], name, &current_inode_index) != 1)
         {
+            stats_record_op(FS_OP_LOOKUP, start, -1);
             return -1;
         }
+    }
 
-        int found = 0;
-        for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
-        {
-            if (current_inode->i_direct_pointers[dp] == 0)
-            {
-                continue;
-            }
+    *inode_index = current_inode_index;
+    stats_record_op(FS_OP_LOOKUP, start, 0);
+    return 0;
+}
 
-            union block data_block;
-            if (disk_read(current_inode->i_direct_pointers[dp], &data_block) < 0)
-            {
-                return -1;
-            }
+static int is_dot_name(const char *name)
+{
+    return strcmp(name, ".") == 0 || strcmp(name, "..") == 0;
+}
 
-            struct directory_entry *entries = data_block.directory_entries;
-            for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
-            {
-                entries[i].name[MAX_NAME_LEN - 1] = '\0';
-                if (entries[i].inode != 0 && strcmp(entries[i].name, name) == 0)
-                {
-                    inode_index = entries[i].inode;
-                    found = 1;
-                    break;
-                }
-            }
+/**
+ * @return 1 if `inode_index` is directory `dir_inode_index` or one of its ancestors, 0 otherwise.
+ */
+static int is_self_or_ancestor(uint32_t inode_index, uint32_t dir_inode_index)
+{
+    for (uint32_t ancestor = dir_inode_index;; ancestor = INODE_HOT[ancestor].parent)
+    {
+        if (ancestor == inode_index)
+            return 1;
+        if (ancestor == ROOT_DIR_INODE)
+            return 0;
+    }
+}
 
-            if (found)
+/**
+ * Splits `path` into its last component, copied to `name`, and the directory
+ * holding it, which is resolved. The root itself has no parent.
+ */
+static int resolve_parent(const char *path, uint32_t *parent_inode_index, char name[MAX_NAME_LEN])
+{
+    char path_copy[256];
+    strncpy(path_copy, path, sizeof(path_copy));
+    path_copy[sizeof(path_copy) - 1] = '\0';
+
+    size_t len = strlen(path_copy);
+    while (len > 1 && path_copy[len - 1] == '/')
+        path_copy[--len] = '\0';
+
+    char *slash = strrchr(path_copy, '/');
+    if (slash[1] == '\0')
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' has no parent directory.", path);
+        return -1;
+    }
+
+    strncpy(name, slash + 1, MAX_NAME_LEN);
+    name[MAX_NAME_LEN - 1] = '\0';
+    slash[slash == path_copy ? 1 : 0] = '\0';
+
+    if (resolve_path(path_copy, parent_inode_index) < 0 || !INODE_HOT[*parent_inode_index].is_directory)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Parent directory of '%s' not found.", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Finds `name` in directory `dir_inode_index` and leaves the block holding it
+ * in `data_block`.
+ *
+ * @return 1 with the entry's slot in `slot` if found, 0 if not, -1 on error.
+ */
+static int find_entry_slot(uint32_t dir_inode_index, const char *name, union block *data_block, uint32_t *slot)
+{
+    struct inode *dir_inode = &INODE_TABLE[dir_inode_index];
+
+    for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+    {
+        if (dir_inode->i_direct_pointers[dp] == 0 || INODE_INFO[dir_inode_index].block_entries[dp] == 0)
+            continue;
+
+        if (read_block(DISK_TAG_DIRECTORY, dir_inode->i_direct_pointers[dp], data_block) < 0)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to read directory data.");
+            return -1;
+        }
+
+        struct directory_entry *entries = data_block->directory_entries;
+        for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
+        {
+            entries[i].name[MAX_NAME_LEN - 1] = '\0';
+            if (entries[i].inode != 0 && strcmp(entries[i].name, name) == 0)
             {
-                break;
+                *slot = dp * DIRENTS_PER_BLOCK + i;
+                return 1;
             }
         }
+    }
 
-        if (!found)
+    return 0;
+}
+
+/**
+ * @return 1 if directory `dir_inode_index` holds nothing but "." and "..",
+ * 0 if it has other entries, -1 on error.
+ */
+static int dir_is_empty(uint32_t dir_inode_index)
+{
+    struct inode *dir_inode = &INODE_TABLE[dir_inode_index];
+
+    for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+    {
+        if (dir_inode->i_direct_pointers[dp] == 0 || INODE_INFO[dir_inode_index].block_entries[dp] == 0)
+            continue;
+
+        union block data_block;
+        if (read_block(DISK_TAG_DIRECTORY, dir_inode->i_direct_pointers[dp], &data_block) < 0)
         {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to read directory data.");
             return -1;
         }
 
-        current_inode_index = inode_index;
+        struct directory_entry *entries = data_block.directory_entries;
+        for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
+        {
+            entries[i].name[MAX_NAME_LEN - 1] = '\0';
+            if (entries[i].inode != 0 && strcmp(entries[i].name, ".") != 0 && strcmp(entries[i].name, "..") != 0)
+                return 0;
+        }
     }
 
-    struct inode *dir_inode = &INODE_TABLE[current_inode_index];
+    return 1;
+}
+
+/**
+ * Returns the slot holding the physical block number of logical block
+ * `block_index`, either in the inode itself or in the already loaded
+ * indirect block.
+ */
+static uint32_t *file_block_slot(struct inode *inode, union block *indirect_block, size_t block_index)
+{
+    if (block_index < INODE_DIRECT_POINTERS)
+        return &inode->i_direct_pointers[block_index];
+
+    return &indirect_block->pointers[block_index - INODE_DIRECT_POINTERS];
+}
+
+static uint32_t inode_table_block_count()
+{
+    return SUPERBLOCK.superblock.s_data_blocks_start - SUPERBLOCK.superblock.s_inode_table_block_start;
+}
+
+static size_t cache_line_round(size_t bytes)
+{
+    return (bytes + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+}
+
+/**
+ * Allocates the inode arena: the zeroed hot fields, then the inodes, then the
+ * zeroed directory bookkeeping, each starting on a cache line.
+ */
+static int alloc_inode_arena(uint32_t total_inodes)
+{
+    size_t hot_bytes = cache_line_round(total_inodes * sizeof(struct inode_hot));
+    size_t table_bytes = cache_line_round(total_inodes * sizeof(struct inode));
+    size_t info_bytes = cache_line_round(total_inodes * sizeof(struct inode_info));
 
-    if (!dir_inode->i_is_directory)
+    uint8_t *arena = aligned_alloc(CACHE_LINE_SIZE, hot_bytes + table_bytes + info_bytes);
+    if (!arena)
     {
-        printf("Error: '%s' is not a directory.\n", path);
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to allocate memory for inode table.");
         return -1;
     }
 
-    calculate_directory_size(current_inode_index);
+    memset(arena, 0, hot_bytes);
+    memset(arena + hot_bytes + table_bytes, 0, info_bytes);
 
-    for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+    INODE_ARENA = arena;
+    INODE_HOT = (struct inode_hot *)arena;
+    INODE_TABLE = (struct inode *)(arena + hot_bytes);
+    INODE_INFO = (struct inode_info *)(arena + hot_bytes + table_bytes);
+    return 0;
+}
+
+static void free_inode_arena()
+{
+    free(INODE_ARENA);
+    INODE_ARENA = NULL;
+    INODE_HOT = NULL;
+    INODE_TABLE = NULL;
+    INODE_INFO = NULL;
+}
+
+/**
+ * Reads an inode table, either the live one or a snapshot's frozen copy,
+ * into a newly allocated inode arena.
+ */
+static int load_inode_table(uint32_t start_block)
+{
+    uint32_t inode_table_blocks = inode_table_block_count();
+    uint32_t inodes_per_block = BLOCK_SIZE / sizeof(struct inode);
+    uint32_t total_inodes = inodes_per_block * inode_table_blocks;
+
+    if (alloc_inode_arena(total_inodes) < 0)
+        return -1;
+
+    uint32_t inode_index = 0;
+    union block inode_block;
+
+    for (uint32_t i = 0; i < inode_table_blocks; i++)
     {
-        if (dir_inode->i_direct_pointers[dp] == 0)
+        if (read_block(DISK_TAG_INODE, start_block + i, &inode_block) < 0)
         {
-            continue;
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to load inode table from disk.");
+            free_inode_arena();
+            return -1;
+        }
+
+        for (uint32_t j = 0; j < inodes_per_block && inode_index < total_inodes; j++, inode_index++)
+        {
+            INODE_TABLE[inode_index] = inode_block.inodes[j];
+            INODE_HOT[inode_index].size = inode_block.inodes[j].i_size;
+            INODE_HOT[inode_index].is_directory = inode_block.inodes[j].i_is_directory;
+            INODE_HOT[inode_index].flags = inode_block.inodes[j].i_flags;
+        }
+    }
+
+    return 0;
+}
+
+static int store_inode_table(uint32_t start_block)
+{
+    uint32_t inode_table_blocks = inode_table_block_count();
+    uint32_t inodes_per_block = BLOCK_SIZE / sizeof(struct inode);
+    uint32_t inode_index = 0;
+    union block inode_block;
+
+    for (uint32_t i = 0; i < inode_table_blocks; i++)
+    {
+        for (uint32_t j = 0; j < inodes_per_block; j++, inode_index++)
+        {
+            inode_block.inodes[j] = INODE_TABLE[inode_index];
+            inode_block.inodes[j].i_size = INODE_HOT[inode_index].size;
+            inode_block.inodes[j].i_is_directory = INODE_HOT[inode_index].is_directory;
+            inode_block.inodes[j].i_flags = INODE_HOT[inode_index].flags;
         }
 
-        union block dir_data_block;
-        if (disk_read(dir_inode->i_direct_pointers[dp], &dir_data_block) < 0)
+        if (write_block(DISK_TAG_INODE, start_block + i, &inode_block) < 0)
         {
-            printf("Error: Failed to read directory data.\n");
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to write inode table to disk.");
             return -1;
         }
+    }
 
-        struct directory_entry *dir_entries = dir_data_block.directory_entries;
+    return 0;
+}
 
-        for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
+/**
+ * Loads the reference count table. Volumes that never had a snapshot have
+ * none, and every block starts with a single owner.
+ */
+static int load_refcounts()
+{
+    uint32_t table_blocks = (SUPERBLOCK.superblock.s_blocks_count + REFCOUNTS_PER_BLOCK - 1) / REFCOUNTS_PER_BLOCK;
+
+    // Table blocks are read and written in place, so they must be block aligned.
+    REFCOUNTS = aligned_alloc(BLOCK_SIZE, (size_t)table_blocks * BLOCK_SIZE);
+    if (!REFCOUNTS)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to allocate memory for reference counts.");
+        return -1;
+    }
+    memset(REFCOUNTS, 0, (size_t)table_blocks * BLOCK_SIZE);
+
+    for (uint32_t i = 0; i < SUPERBLOCK.superblock.s_refcount_table_blocks; i++)
+    {
+        if (read_block(DISK_TAG_REFCOUNT, SUPERBLOCK.superblock.s_refcount_table_start + i,
+                       REFCOUNTS + i * REFCOUNTS_PER_BLOCK) < 0)
         {
-            if (dir_entries[i].inode != 0)
-            {
-                dir_entries[i].name[MAX_NAME_LEN - 1] = '\0';
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to read reference count table.");
+            free(REFCOUNTS);
+            REFCOUNTS = NULL;
+            return -1;
+        }
+    }
 
-                if (strcmp(dir_entries[i].name, ".") == 0 || strcmp(dir_entries[i].name, "..") == 0)
-                {
-                    continue;
-                }
+    return 0;
+}
 
-                struct inode *entry_inode = &INODE_TABLE[dir_entries[i].inode];
-                printf("%s %llu\n", dir_entries[i].name, (unsigned long long)entry_inode->i_size);
-            }
+static int store_refcounts()
+{
+    for (uint32_t i = 0; i < SUPERBLOCK.superblock.s_refcount_table_blocks; i++)
+    {
+        if (write_block(DISK_TAG_REFCOUNT, SUPERBLOCK.superblock.s_refcount_table_start + i,
+                        REFCOUNTS + i * REFCOUNTS_PER_BLOCK) < 0)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to write reference count table.");
+            return -1;
         }
     }
 
     return 0;
 }
 
-int fs_write(const char *path, const void *buf, size_t count, int append)
+static int find_snapshot(const char *name)
+{
+    for (int i = 0; i < FS_MAX_SNAPSHOTS; i++)
+    {
+        struct snapshot_record *record = &SUPERBLOCK.superblock.s_snapshots[i];
+        if (record->inode_table_start != 0 && strncmp(record->name, name, FS_SNAPSHOT_NAME_LEN) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+/**
+ * Mounts the live filesystem, or with a snapshot name, that snapshot's frozen
+ * inode table read-only.
+ */
+static int mount_volume(const char *snapshot_name)
+{
+    if (MOUNT_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem already mounted.");
+        return -1;
+    }
+
+    // Block buffers are aligned to the block size so they can be used for direct I/O.
+    if (slab_init(FS_SLAB_BLOCK, BLOCK_SIZE, BLOCK_SIZE) < 0 ||
+        slab_init(FS_SLAB_DIR_HANDLE, sizeof(struct fs_dir), CACHE_LINE_SIZE) < 0)
+        return -1;
+
+    if (read_block(DISK_TAG_SUPERBLOCK, 0, &SUPERBLOCK) < 0 ||
+        read_block(DISK_TAG_BITMAP, 1, &BLOCK_BITMAP) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to read filesystem metadata.");
+        return -1;
+    }
+
+    uint32_t inode_table_start = SUPERBLOCK.superblock.s_inode_table_block_start;
+    uint32_t inode_bitmap = SUPERBLOCK.superblock.s_inode_bitmap;
+
+    if (snapshot_name)
+    {
+        int snapshot = find_snapshot(snapshot_name);
+        if (snapshot < 0)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Snapshot '%s' not found.", snapshot_name);
+            return -1;
+        }
+
+        inode_table_start = SUPERBLOCK.superblock.s_snapshots[snapshot].inode_table_start;
+        inode_bitmap = SUPERBLOCK.superblock.s_snapshots[snapshot].inode_bitmap;
+    }
+
+    if (read_block(DISK_TAG_BITMAP, inode_bitmap, &INODE_BITMAP) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to read filesystem metadata.");
+        return -1;
+    }
+
+    memset(&UNWRITTEN_BITMAP, 0, sizeof(UNWRITTEN_BITMAP));
+    if (SUPERBLOCK.superblock.s_unwritten_bitmap != 0 &&
+        read_block(DISK_TAG_BITMAP, SUPERBLOCK.superblock.s_unwritten_bitmap, &UNWRITTEN_BITMAP) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to read unwritten extent bitmap.");
+        return -1;
+    }
+
+    if (load_refcounts() < 0)
+    {
+        return -1;
+    }
+
+    if (load_inode_table(inode_table_start) < 0)
+    {
+        free(REFCOUNTS);
+        return -1;
+    }
+
+    if (build_inode_info(inode_table_block_count() * (BLOCK_SIZE / sizeof(struct inode))) < 0)
+    {
+        free_inode_arena();
+        free(REFCOUNTS);
+        return -1;
+    }
+
+    memset(BMAP_CACHE, 0, sizeof(BMAP_CACHE));
+    cluster_cache_block = 0;
+    pending_free_count = 0;
+    READONLY_FLAG = snapshot_name != NULL;
+    MOUNT_FLAG = 1;
+    DISK_OPEN_FLAG = 1;
+    FS_LOG(FS_LOG_INFO, "Filesystem mounted successfully.");
+    return 0;
+}
+
+int fs_mount()
+{
+    return mount_volume(NULL);
+}
+
+int fs_mount_snapshot(const char *name)
+{
+    if (!name)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Invalid snapshot name.");
+        return -1;
+    }
+
+    return mount_volume(name);
+}
+
+void fs_unmount()
+{
+    if (!MOUNT_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
+        return;
+    }
+
+    // A snapshot mount changes nothing on disk.
+    if (!READONLY_FLAG)
+    {
+        store_inode_table(SUPERBLOCK.superblock.s_inode_table_block_start);
+        flush_pending_frees();
+
+        if (write_block(DISK_TAG_BITMAP, SUPERBLOCK.superblock.s_block_bitmap, &BLOCK_BITMAP) < 0 ||
+            write_block(DISK_TAG_BITMAP, SUPERBLOCK.superblock.s_inode_bitmap, &INODE_BITMAP) < 0 ||
+            (SUPERBLOCK.superblock.s_unwritten_bitmap != 0 &&
+             write_block(DISK_TAG_BITMAP, SUPERBLOCK.superblock.s_unwritten_bitmap, &UNWRITTEN_BITMAP) < 0))
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to write bitmaps to disk.");
+        }
+
+        store_refcounts();
+
+        if (disk_sync() < 0)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to write block checksums to disk.");
+        }
+    }
+
+    free_inode_arena();
+    free(REFCOUNTS);
+    free_dedup_index();
+    REFCOUNTS = NULL;
+    READONLY_FLAG = 0;
+    MOUNT_FLAG = 0;
+    FS_LOG(FS_LOG_INFO, "Filesystem unmounted successfully.");
+}
+
+static int create_path(const char *path, int is_directory)
 {
     if (!MOUNT_FLAG)
     {
-        printf("Error: Filesystem not mounted.\n");
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
         return -1;
     }
 
-    if (!path || path[0] != '/')
+    if (READONLY_FLAG)
     {
-        printf("Error: Path must be absolute and start with '/'.\n");
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem is mounted read-only.");
         return -1;
     }
 
-    if (!buf || count == 0)
+    if (!path || path[0] != '/')
     {
-        printf("Error: Invalid buffer or count.\n");
+        FS_LOG(FS_LOG_ERROR, "Error: Path must be absolute.");
         return -1;
     }
 
@@ -858,50 +1609,49 @@ int fs_write(const char *path, const void *buf, size_t count, int append)
     path_copy[sizeof(path_copy) - 1] = '\0';
 
     char *token;
-    char *rest = NULL;
+    char *rest = path_copy;
     uint32_t parent_inode_index = ROOT_DIR_INODE;
-    uint32_t file_inode_index = 0;
+    uint32_t inode_index;
     char name[MAX_NAME_LEN];
 
-    struct inode *parent_inode = NULL;
-    struct inode *file_inode = NULL;
-
-    char current_path[256] = "/";
-
-    while ((token = strtok_r(rest ? NULL : path_copy, "/", &rest)))
+    while ((token = strtok_r(rest, "/", &rest)))
     {
         strncpy(name, token, MAX_NAME_LEN);
         name[MAX_NAME_LEN - 1] = '\0';
 
-        if (strcmp(current_path, "/") == 0)
-            snprintf(current_path + strlen(current_path), sizeof(current_path) - strlen(current_path), "%s", name);
-        else
-            snprintf(current_path + strlen(current_path), sizeof(current_path) - strlen(current_path), "/%s", name);
-
-        parent_inode = &INODE_TABLE[parent_inode_index];
+        int is_last_component = (rest == NULL || *rest == '\0');
+        int found = 0;
+        struct inode *parent_inode = &INODE_TABLE[parent_inode_index];
 
-        if (!parent_inode->i_is_directory)
+        if (!INODE_HOT[parent_inode_index].is_directory)
         {
-            printf("Error: '%s' is not a directory.\n", name);
+            FS_LOG(FS_LOG_ERROR, "Error: Parent is not a directory.");
             return -1;
         }
 
-        int found = 0;
-        uint32_t inode_index = 0;
+        // One pass over the blocks that hold entries. The block the free
+        // slot hint points into is kept, so inserting needs no second read.
+        struct inode_info *parent_info = &INODE_INFO[parent_inode_index];
+        uint32_t free_slot = parent_info->free_hint;
+        int hint_dp = free_slot < DIR_SLOTS ? (int)(free_slot / DIRENTS_PER_BLOCK) : -1;
+        int hint_block_loaded = 0;
+        union block data_block;
+        union block hint_block;
 
         for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
         {
-            if (parent_inode->i_direct_pointers[dp] == 0)
+            if (parent_inode->i_direct_pointers[dp] == 0 || parent_info->block_entries[dp] == 0)
                 continue;
 
-            union block data_block;
-            if (disk_read(parent_inode->i_direct_pointers[dp], &data_block) < 0)
+            union block *block = dp == hint_dp ? &hint_block : &data_block;
+            if (read_block(DISK_TAG_DIRECTORY, parent_inode->i_direct_pointers[dp], block) < 0)
             {
-                printf("Error: Failed to read directory data.\n");
+                FS_LOG(FS_LOG_ERROR, "Error: Failed to read directory data.");
                 return -1;
             }
+            hint_block_loaded |= dp == hint_dp;
 
-            struct directory_entry *entries = data_block.directory_entries;
+            struct directory_entry *entries = block->directory_entries;
             for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
             {
                 entries[i].name[MAX_NAME_LEN - 1] = '\0';
@@ -912,434 +1662,2985 @@ int fs_write(const char *path, const void *buf, size_t count, int append)
                     break;
                 }
             }
-
             if (found)
                 break;
         }
 
-        if (rest == NULL || *rest == '\0')
+        if (!found)
         {
-
-            if (found)
+            if (is_last_component || is_directory)
             {
-                file_inode_index = inode_index;
-                file_inode = &INODE_TABLE[file_inode_index];
-                if (file_inode->i_is_directory)
+                if (free_slot >= DIR_SLOTS)
                 {
-                    printf("Error: '%s' is a directory.\n", path);
+                    FS_LOG(FS_LOG_ERROR, "Error: No space in directory.");
                     return -1;
                 }
-            }
-            else
-            {
 
-                if (fs_create(current_path, 0) == -1)
+                uint32_t total_inodes = SUPERBLOCK.superblock.s_inodes_count;
+                uint32_t new_inode_index = (uint32_t)-1;
+                for (uint32_t i = 0; i < total_inodes; i++)
+                {
+                    if (!BITMAP_TEST(INODE_BITMAP.bitmap, i))
+                    {
+                        new_inode_index = i;
+                        break;
+                    }
+                }
+                if (new_inode_index == (uint32_t)-1)
                 {
-                    printf("Error: Could not create file: %s\n", current_path);
+                    FS_LOG(FS_LOG_ERROR, "Error: No available inodes.");
                     return -1;
                 }
 
-                parent_inode = &INODE_TABLE[parent_inode_index];
+                BITMAP_SET(INODE_BITMAP.bitmap, new_inode_index);
+                struct inode *new_inode = &INODE_TABLE[new_inode_index];
+                struct inode_hot *new_hot = &INODE_HOT[new_inode_index];
+                memset(new_inode, 0, sizeof(struct inode));
+                init_inode_info(new_inode_index, parent_inode_index, is_last_component ? is_directory : 1);
 
-                found = 0;
-                for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+                if (new_hot->is_directory)
                 {
-                    if (parent_inode->i_direct_pointers[dp] == 0)
-                        continue;
-
-                    union block data_block;
-                    if (disk_read(parent_inode->i_direct_pointers[dp], &data_block) < 0)
+                    uint32_t data_block_index = allocate_data_block();
+                    if (data_block_index == (uint32_t)-1)
                     {
-                        printf("Error: Failed to read directory data.\n");
+                        FS_LOG(FS_LOG_ERROR, "Error: No available data blocks.");
                         return -1;
                     }
 
-                    struct directory_entry *entries = data_block.directory_entries;
-                    for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
+                    union block new_data_block = {0};
+                    struct directory_entry *dir_entries = new_data_block.directory_entries;
+
+                    dir_entries[0].inode = new_inode_index;
+                    strncpy(dir_entries[0].name, ".", MAX_NAME_LEN);
+                    dir_entries[0].name[MAX_NAME_LEN - 1] = '\0';
+
+                    dir_entries[1].inode = parent_inode_index;
+                    strncpy(dir_entries[1].name, "..", MAX_NAME_LEN);
+                    dir_entries[1].name[MAX_NAME_LEN - 1] = '\0';
+
+                    if (write_block(DISK_TAG_DIRECTORY, data_block_index, &new_data_block) < 0)
                     {
-                        entries[i].name[MAX_NAME_LEN - 1] = '\0';
-                        if (entries[i].inode != 0 && strcmp(entries[i].name, name) == 0)
-                        {
-                            file_inode_index = entries[i].inode;
-                            file_inode = &INODE_TABLE[file_inode_index];
-                            found = 1;
-                            break;
-                        }
+                        FS_LOG(FS_LOG_ERROR, "Error: Failed to write data block.");
+                        return -1;
                     }
 
-                    if (found)
-                        break;
+                    new_inode->i_direct_pointers[0] = data_block_index;
+                }
+
+                uint32_t slot;
+                if (claim_free_slot(parent_inode_index, &hint_block, hint_block_loaded, &slot) < 0)
+                    return -1;
+
+                struct directory_entry *entry = &hint_block.directory_entries[slot % DIRENTS_PER_BLOCK];
+                entry->inode = new_inode_index;
+                strncpy(entry->name, name, MAX_NAME_LEN);
+                entry->name[MAX_NAME_LEN - 1] = '\0';
+                if (write_block_cow(DISK_TAG_DIRECTORY, &parent_inode->i_direct_pointers[hint_dp], &hint_block) < 0)
+                {
+                    FS_LOG(FS_LOG_ERROR, "Error: Failed to write directory data.");
+                    return -1;
                 }
+                dir_slot_used(parent_inode_index, slot);
+
+                propagate_usage(parent_inode_index, new_hot->size, new_hot->is_directory ? 0 : 1);
+                parent_inode_index = new_inode_index;
 
-                if (!found)
+                if (is_last_component)
                 {
-                    printf("Error: Failed to locate newly created file.\n");
+                    FS_LOG(FS_LOG_DEBUG, "event=create type=%s path='%s'", is_directory ? "directory" : "file", path);
+                    return 0;
+                }
+            }
+            else
+            {
+                FS_LOG(FS_LOG_DEBUG, "event=create type=directory name='%s' intermediate=1", name);
+                char intermediate_path[256];
+                snprintf(intermediate_path, sizeof(intermediate_path), "/%s", name);
+                if (fs_create(intermediate_path, 1) == -1)
+                {
+                    FS_LOG(FS_LOG_ERROR, "Error: Failed to create intermediate directory: %s", name);
                     return -1;
                 }
             }
         }
         else
         {
+            if (is_last_component)
+            {
+                FS_LOG(FS_LOG_ERROR, "Error: File or directory already exists.");
+                return -1;
+            }
+            parent_inode_index = inode_index;
+        }
+    }
+
+    FS_LOG(FS_LOG_ERROR, "Error: Cannot create root directory.");
+    return -1;
+}
+
+int fs_create(const char *path, int is_directory)
+{
+    uint64_t start = stats_now_ns();
+    trace_depth++;
+    int result = create_path(path, is_directory);
+    trace_depth--;
+    stats_record_op(FS_OP_CREATE, start, result);
+    TRACE_OP(is_directory ? TRACE_MKDIR : TRACE_CREATE, path, 0, 0, start, result);
+    return result;
+}
+
+/*
+ * The stack of directories still to remove, kept in FS_SLAB_BLOCK objects so
+ * that removing a tree never calls malloc. A chunk is chained onto the one
+ * below it when that one fills up.
+ */
+#define DIR_STACK_CHUNK_ENTRIES ((BLOCK_SIZE - sizeof(void *)) / sizeof(uint32_t))
+
+struct dir_stack_chunk
+{
+    struct dir_stack_chunk *below;
+    uint32_t inodes[DIR_STACK_CHUNK_ENTRIES];
+};
+
+_Static_assert(sizeof(struct dir_stack_chunk) <= BLOCK_SIZE, "struct dir_stack_chunk must fit a slab block");
+
+static void free_dir_stack(struct dir_stack_chunk *top)
+{
+    while (top)
+    {
+        struct dir_stack_chunk *below = top->below;
+        slab_free(FS_SLAB_BLOCK, top);
+        top = below;
+    }
+}
+
+static int push_dir_stack(struct dir_stack_chunk **top, size_t *top_size, uint32_t inode_index)
+{
+    if (!*top || *top_size == DIR_STACK_CHUNK_ENTRIES)
+    {
+        struct dir_stack_chunk *chunk = slab_alloc(FS_SLAB_BLOCK);
+        if (!chunk)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to allocate memory for directory removal.");
+            return -1;
+        }
+        chunk->below = *top;
+        *top = chunk;
+        *top_size = 0;
+    }
 
-            if (!found)
+    (*top)->inodes[(*top_size)++] = inode_index;
+    return 0;
+}
+
+static uint32_t pop_dir_stack(struct dir_stack_chunk **top, size_t *top_size)
+{
+    if (*top_size == 0)
+    {
+        struct dir_stack_chunk *empty = *top;
+        *top = empty->below;
+        *top_size = DIR_STACK_CHUNK_ENTRIES;
+        slab_free(FS_SLAB_BLOCK, empty);
+    }
+
+    return (*top)->inodes[--(*top_size)];
+}
+
+/**
+ * Releases a directory subtree rooted at `dir_inode_index` without recursion.
+ *
+ * Subdirectories are pushed onto an explicit stack, so every directory block is
+ * read exactly once and none of the removed directories' blocks are rewritten.
+ * The caller is responsible for clearing the entry that references the root.
+ */
+static int remove_directory_tree(uint32_t dir_inode_index)
+{
+    struct dir_stack_chunk *stack = NULL;
+    size_t stack_size = 0;
+
+    if (push_dir_stack(&stack, &stack_size, dir_inode_index) < 0)
+        return -1;
+
+    while (stack_size > 0 || stack->below)
+    {
+        uint32_t current_inode_index = pop_dir_stack(&stack, &stack_size);
+        struct inode *current_inode = &INODE_TABLE[current_inode_index];
+
+        for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+        {
+            if (current_inode->i_direct_pointers[dp] == 0)
             {
+                continue;
+            }
 
-                if (fs_create(current_path, 1) == -1)
+            union block dir_data_block;
+            if (read_block(DISK_TAG_DIRECTORY, current_inode->i_direct_pointers[dp], &dir_data_block) < 0)
+            {
+                FS_LOG(FS_LOG_ERROR, "Error: Failed to read directory data.");
+                free_dir_stack(stack);
+                return -1;
+            }
+
+            struct directory_entry *entries = dir_data_block.directory_entries;
+            for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
+            {
+                if (entries[i].inode == 0)
                 {
-                    printf("Error: Could not create directory: '%s'.\n", current_path);
-                    return -1;
+                    continue;
                 }
 
-                parent_inode = &INODE_TABLE[parent_inode_index];
-
-                found = 0;
-                for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+                entries[i].name[MAX_NAME_LEN - 1] = '\0';
+                if (strcmp(entries[i].name, ".") == 0 || strcmp(entries[i].name, "..") == 0)
                 {
-                    if (parent_inode->i_direct_pointers[dp] == 0)
-                        continue;
+                    continue;
+                }
 
-                    union block data_block;
-                    if (disk_read(parent_inode->i_direct_pointers[dp], &data_block) < 0)
-                    {
-                        printf("Error: Failed to read directory data.\n");
-                        return -1;
-                    }
+                uint32_t child_inode_index = entries[i].inode;
+                struct inode *child_inode = &INODE_TABLE[child_inode_index];
 
-                    struct directory_entry *entries = data_block.directory_entries;
-                    for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
+                if (INODE_HOT[child_inode_index].is_directory)
+                {
+                    if (push_dir_stack(&stack, &stack_size, child_inode_index) < 0)
                     {
-                        entries[i].name[MAX_NAME_LEN - 1] = '\0';
-                        if (entries[i].inode != 0 && strcmp(entries[i].name, name) == 0)
-                        {
-                            inode_index = entries[i].inode;
-                            found = 1;
-                            break;
-                        }
+                        free_dir_stack(stack);
+                        return -1;
                     }
-
-                    if (found)
-                        break;
+                    continue;
                 }
 
-                if (!found)
+                if (release_file_blocks(child_inode) < 0)
                 {
-                    printf("Error: Failed to locate newly created directory.\n");
+                    free_dir_stack(stack);
                     return -1;
                 }
+
+                free_inode(child_inode_index);
+            }
+
+            release_data_block(current_inode->i_direct_pointers[dp]);
+            current_inode->i_direct_pointers[dp] = 0;
+        }
+
+        free_inode(current_inode_index);
+    }
+
+    free_dir_stack(stack);
+    return 0;
+}
+
+static int remove_path(const char *path)
+{
+    if (!MOUNT_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
+        return -1;
+    }
+
+    if (READONLY_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem is mounted read-only.");
+        return -1;
+    }
+
+    if (!path || path[0] != '/')
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Path must be absolute and start with '/'.");
+        return -1;
+    }
+
+    char path_copy[256];
+    strncpy(path_copy, path, sizeof(path_copy));
+    path_copy[sizeof(path_copy) - 1] = '\0';
+
+    char *token;
+    char *rest = path_copy;
+    uint32_t parent_inode_index = ROOT_DIR_INODE;
+    uint32_t target_inode_index = ROOT_DIR_INODE;
+    uint32_t entry_block_num = 0;
+    int entry_dp = 0;
+    unsigned int entry_slot = 0;
+    char name[MAX_NAME_LEN];
+
+    while ((token = strtok_r(rest, "/", &rest)))
+    {
+        strncpy(name, token, MAX_NAME_LEN);
+        name[MAX_NAME_LEN - 1] = '\0';
+
+        struct inode *parent_inode = &INODE_TABLE[parent_inode_index];
+        if (!INODE_HOT[parent_inode_index].is_directory)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: '%s' is not a directory.", path);
+            return -1;
+        }
+
+        int found = 0;
+        for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+        {
+            if (parent_inode->i_direct_pointers[dp] == 0 || INODE_INFO[parent_inode_index].block_entries[dp] == 0)
+            {
+                continue;
+            }
+
+            union block parent_data_block;
+            if (read_block(DISK_TAG_DIRECTORY, parent_inode->i_direct_pointers[dp], &parent_data_block) < 0)
+            {
+                FS_LOG(FS_LOG_ERROR, "Error: Failed to read directory data.");
+                return -1;
+            }
+
+            struct directory_entry *entries = parent_data_block.directory_entries;
+            for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
+            {
+                entries[i].name[MAX_NAME_LEN - 1] = '\0';
+                if (entries[i].inode != 0 && strcmp(entries[i].name, name) == 0)
+                {
+                    target_inode_index = entries[i].inode;
+                    entry_block_num = parent_inode->i_direct_pointers[dp];
+                    entry_dp = dp;
+                    entry_slot = i;
+                    found = 1;
+                    break;
+                }
             }
 
-            parent_inode_index = inode_index;
-        }
+            if (found)
+            {
+                break;
+            }
+        }
+
+        if (!found)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: '%s' not found.", path);
+            return -1;
+        }
+
+        if (rest == NULL || *rest == '\0')
+        {
+
+            break;
+        }
+        else
+        {
+
+            parent_inode_index = target_inode_index;
+        }
+    }
+
+    if (entry_block_num == 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Cannot remove root directory.");
+        return -1;
+    }
+
+    // "." and ".." name the parent or one of its ancestors, whose removal would
+    // release the directory that holds the entry being cleared.
+    if (is_dot_name(name) || is_self_or_ancestor(target_inode_index, parent_inode_index))
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Cannot remove '%s'.", path);
+        return -1;
+    }
+
+    struct inode *target_inode = &INODE_TABLE[target_inode_index];
+    struct inode_hot *target_hot = &INODE_HOT[target_inode_index];
+    int64_t removed_bytes = usage_bytes(target_inode_index);
+    int32_t removed_files = target_hot->is_directory ? target_hot->file_count : 1;
+
+    if (target_hot->is_directory)
+    {
+        if (remove_directory_tree(target_inode_index) < 0)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        if (release_file_blocks(target_inode) < 0)
+        {
+            return -1;
+        }
+
+        free_inode(target_inode_index);
+    }
+
+    union block parent_data_block;
+    if (read_block(DISK_TAG_DIRECTORY, entry_block_num, &parent_data_block) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to read parent directory data.");
+        return -1;
+    }
+
+    memset(&parent_data_block.directory_entries[entry_slot], 0, sizeof(struct directory_entry));
+    if (write_block_cow(DISK_TAG_DIRECTORY, &INODE_TABLE[parent_inode_index].i_direct_pointers[entry_dp],
+                        &parent_data_block) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to update parent directory.");
+        return -1;
+    }
+
+    dir_slot_freed(parent_inode_index, entry_dp * DIRENTS_PER_BLOCK + entry_slot);
+    propagate_usage(parent_inode_index, -removed_bytes, -removed_files);
+    FS_LOG(FS_LOG_DEBUG, "event=remove path='%s'", path);
+    return 0;
+}
+
+int fs_remove(const char *path)
+{
+    uint64_t start = stats_now_ns();
+    trace_depth++;
+    int result = remove_path(path);
+    trace_depth--;
+    stats_record_op(FS_OP_REMOVE, start, result);
+    TRACE_OP(TRACE_REMOVE, path, 0, 0, start, result);
+    return result;
+}
+
+/*
+ * A directory's blocks, read once and patched in memory by the batch
+ * operations. Each block that changed is written back once.
+ */
+struct dir_batch
+{
+    uint32_t inode_index;
+    union block *blocks[INODE_DIRECT_POINTERS];
+    uint8_t dirty[INODE_DIRECT_POINTERS];
+};
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/**
+ * Checks the names of a batch and returns them sorted, or NULL if one is
+ * invalid or appears twice.
+ */
+static const char **sort_batch_names(const char *const *names, size_t count)
+{
+    const char **sorted = malloc(count * sizeof(char *));
+    if (!sorted)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to allocate memory for batch.");
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const char *name = names[i];
+        if (!name || name[0] == '\0' || strlen(name) >= MAX_NAME_LEN || strchr(name, '/') ||
+            strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Invalid name in batch.");
+            free(sorted);
+            return NULL;
+        }
+        sorted[i] = name;
+    }
+
+    qsort(sorted, count, sizeof(char *), compare_names);
+    for (size_t i = 1; i < count; i++)
+    {
+        if (strcmp(sorted[i - 1], sorted[i]) == 0)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: '%s' appears twice in batch.", sorted[i]);
+            free(sorted);
+            return NULL;
+        }
+    }
+
+    return sorted;
+}
+
+static void free_dir_batch(struct dir_batch *batch)
+{
+    for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+    {
+        slab_free(FS_SLAB_BLOCK, batch->blocks[dp]);
+    }
+}
+
+/**
+ * Resolves `parent` and reads all of its directory blocks into buffers from
+ * the block slab, which free_dir_batch() returns.
+ */
+static int load_dir_batch(const char *parent, struct dir_batch *batch)
+{
+    if (!MOUNT_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
+        return -1;
+    }
+
+    if (READONLY_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem is mounted read-only.");
+        return -1;
+    }
+
+    if (!parent || parent[0] != '/' || resolve_path(parent, &batch->inode_index) < 0 ||
+        !INODE_HOT[batch->inode_index].is_directory)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Directory '%s' not found.", parent ? parent : "");
+        return -1;
+    }
+
+    memset(batch->dirty, 0, sizeof(batch->dirty));
+    memset(batch->blocks, 0, sizeof(batch->blocks));
+    for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+    {
+        batch->blocks[dp] = slab_alloc(FS_SLAB_BLOCK);
+        if (!batch->blocks[dp])
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to allocate memory for batch.");
+            free_dir_batch(batch);
+            return -1;
+        }
+    }
+
+    struct inode *dir_inode = &INODE_TABLE[batch->inode_index];
+    for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+    {
+        if (dir_inode->i_direct_pointers[dp] == 0)
+            continue;
+
+        // A block without entries needs no read: every slot in it is free.
+        if (INODE_INFO[batch->inode_index].block_entries[dp] == 0)
+        {
+            memset(batch->blocks[dp], 0, sizeof(union block));
+            continue;
+        }
+
+        if (read_block(DISK_TAG_DIRECTORY, dir_inode->i_direct_pointers[dp], batch->blocks[dp]) < 0)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to read directory data.");
+            free_dir_batch(batch);
+            return -1;
+        }
+
+        for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
+        {
+            batch->blocks[dp]->directory_entries[i].name[MAX_NAME_LEN - 1] = '\0';
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Writes back the blocks a batch changed.
+ */
+static int store_dir_batch(struct dir_batch *batch)
+{
+    struct inode *dir_inode = &INODE_TABLE[batch->inode_index];
+    int result = 0;
+
+    for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+    {
+        if (batch->dirty[dp] &&
+            write_block_cow(DISK_TAG_DIRECTORY, &dir_inode->i_direct_pointers[dp], batch->blocks[dp]) < 0)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to write directory data.");
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+static void trace_batch(enum trace_op op, const char *parent, const char *const *names, size_t count,
+                        uint64_t start, int result)
+{
+    if (!trace_enabled || trace_depth != 0)
+        return;
+
+    char path[512];
+    for (size_t i = 0; i < count; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", strcmp(parent, "/") == 0 ? "" : parent, names[i]);
+        TRACE_OP(op, path, 0, 0, start, result);
+    }
+}
+
+static int create_batch(const char *parent, const char *const *names, size_t count, int is_directory)
+{
+    struct dir_batch batch;
+    if (load_dir_batch(parent, &batch) < 0)
+        return -1;
+
+    struct inode *dir_inode = &INODE_TABLE[batch.inode_index];
+    const char **sorted = sort_batch_names(names, count);
+    uint32_t *inodes = malloc(count * sizeof(uint32_t));
+    uint16_t *slots = malloc(count * sizeof(uint16_t));
+    uint32_t *new_blocks = malloc((count + INODE_DIRECT_POINTERS) * sizeof(uint32_t));
+    size_t new_block_count = 0;
+    size_t used_blocks = 0;
+    int result = -1;
+
+    if (!sorted || !inodes || !slots || !new_blocks)
+    {
+        if (sorted)
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to allocate memory for batch.");
+        goto out;
+    }
+
+    // Reject the batch before changing anything: names must be new, and the
+    // directory must have room for all of them. Free slots in existing blocks
+    // are used first, then new blocks in the empty pointers.
+    size_t planned = 0;
+    for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+    {
+        if (dir_inode->i_direct_pointers[dp] == 0)
+            continue;
+
+        struct directory_entry *entries = batch.blocks[dp]->directory_entries;
+        for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
+        {
+            const char *name = entries[i].name;
+            if (entries[i].inode == 0)
+            {
+                if (planned < count)
+                    slots[planned++] = dp * DIRENTS_PER_BLOCK + i;
+            }
+            else if (bsearch(&name, sorted, count, sizeof(char *), compare_names))
+            {
+                FS_LOG(FS_LOG_ERROR, "Error: '%s' already exists.", name);
+                goto out;
+            }
+        }
+    }
+
+    size_t needed_dir_blocks = 0;
+    for (int dp = 0; dp < INODE_DIRECT_POINTERS && planned < count; dp++)
+    {
+        if (dir_inode->i_direct_pointers[dp] != 0)
+            continue;
+
+        for (unsigned int i = 0; i < DIRENTS_PER_BLOCK && planned < count; i++)
+        {
+            slots[planned++] = dp * DIRENTS_PER_BLOCK + i;
+        }
+        needed_dir_blocks++;
+    }
+
+    if (planned < count)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: No space in directory.");
+        goto out;
+    }
+
+    size_t found_inodes = 0;
+    for (uint32_t i = 0; i < SUPERBLOCK.superblock.s_inodes_count && found_inodes < count; i++)
+    {
+        if (!BITMAP_TEST(INODE_BITMAP.bitmap, i))
+            inodes[found_inodes++] = i;
+    }
+    if (found_inodes < count)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: No available inodes.");
+        goto out;
+    }
+
+    size_t needed_blocks = needed_dir_blocks + (is_directory ? count : 0);
+    for (; new_block_count < needed_blocks; new_block_count++)
+    {
+        new_blocks[new_block_count] = allocate_data_block();
+        if (new_blocks[new_block_count] == (uint32_t)-1)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: No available data blocks.");
+            goto out;
+        }
+    }
+
+    size_t created = 0;
+    result = 0;
+
+    for (; created < count; created++)
+    {
+        uint32_t inode_index = inodes[created];
+        struct inode *new_inode = &INODE_TABLE[inode_index];
+
+        memset(new_inode, 0, sizeof(struct inode));
+
+        if (is_directory)
+        {
+            union block new_data_block = {0};
+            struct directory_entry *dir_entries = new_data_block.directory_entries;
+
+            dir_entries[0].inode = inode_index;
+            strncpy(dir_entries[0].name, ".", MAX_NAME_LEN);
+            dir_entries[1].inode = batch.inode_index;
+            strncpy(dir_entries[1].name, "..", MAX_NAME_LEN);
+
+            if (write_block(DISK_TAG_DIRECTORY, new_blocks[used_blocks], &new_data_block) < 0)
+            {
+                FS_LOG(FS_LOG_ERROR, "Error: Failed to write data block.");
+                result = -1;
+                break;
+            }
+            new_inode->i_direct_pointers[0] = new_blocks[used_blocks++];
+        }
+
+        BITMAP_SET(INODE_BITMAP.bitmap, inode_index);
+        init_inode_info(inode_index, batch.inode_index, is_directory);
+
+        int dp = slots[created] / DIRENTS_PER_BLOCK;
+        if (dir_inode->i_direct_pointers[dp] == 0)
+        {
+            dir_inode->i_direct_pointers[dp] = new_blocks[used_blocks++];
+            memset(batch.blocks[dp], 0, sizeof(union block));
+        }
+
+        struct directory_entry *entry = &batch.blocks[dp]->directory_entries[slots[created] % DIRENTS_PER_BLOCK];
+        memset(entry, 0, sizeof(*entry));
+        entry->inode = inode_index;
+        strncpy(entry->name, names[created], MAX_NAME_LEN - 1);
+        batch.dirty[dp] = 1;
+        dir_slot_used(batch.inode_index, slots[created]);
+    }
+
+    // Entries added so far are written back even if a later one failed.
+    if (store_dir_batch(&batch) < 0)
+        result = -1;
+
+    propagate_usage(batch.inode_index, is_directory ? (int64_t)created * BLOCK_SIZE : 0,
+                    is_directory ? 0 : (int32_t)created);
+    FS_LOG(FS_LOG_DEBUG, "event=create_batch parent='%s' count=%zu", parent, created);
+
+out:
+    for (size_t i = used_blocks; i < new_block_count; i++)
+    {
+        release_data_block(new_blocks[i]);
+    }
+    free_dir_batch(&batch);
+    free(sorted);
+    free(inodes);
+    free(slots);
+    free(new_blocks);
+    return result;
+}
+
+int fs_create_batch(const char *parent, const char *const *names, size_t count, int is_directory)
+{
+    uint64_t start = stats_now_ns();
+    trace_depth++;
+    int result = count == 0 ? 0 : create_batch(parent, names, count, is_directory);
+    trace_depth--;
+    stats_record_op(FS_OP_CREATE, start, result);
+    trace_batch(is_directory ? TRACE_MKDIR : TRACE_CREATE, parent, names, count, start, result);
+    return result;
+}
+
+static int remove_batch(const char *parent, const char *const *names, size_t count)
+{
+    struct dir_batch batch;
+    if (load_dir_batch(parent, &batch) < 0)
+        return -1;
+
+    struct inode *dir_inode = &INODE_TABLE[batch.inode_index];
+    const char **sorted = sort_batch_names(names, count);
+    struct directory_entry **targets = calloc(count, sizeof(struct directory_entry *));
+    uint8_t *target_dp = malloc(count);
+    int result = -1;
+
+    if (!sorted || !targets || !target_dp)
+    {
+        if (sorted)
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to allocate memory for batch.");
+        goto out;
+    }
+
+    // Find every entry in one pass over the directory before removing any.
+    size_t found = 0;
+    for (int dp = 0; dp < INODE_DIRECT_POINTERS && found < count; dp++)
+    {
+        if (dir_inode->i_direct_pointers[dp] == 0)
+            continue;
+
+        struct directory_entry *entries = batch.blocks[dp]->directory_entries;
+        for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
+        {
+            const char *name = entries[i].name;
+            if (entries[i].inode == 0)
+                continue;
+
+            const char **match = bsearch(&name, sorted, count, sizeof(char *), compare_names);
+            if (match && !targets[match - sorted])
+            {
+                targets[match - sorted] = &entries[i];
+                target_dp[match - sorted] = dp;
+                found++;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count && found < count; i++)
+    {
+        if (!targets[i])
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: '%s/%s' not found.", parent, sorted[i]);
+            goto out;
+        }
+    }
+
+    int64_t removed_bytes = 0;
+    int32_t removed_files = 0;
+    result = 0;
+
+    for (size_t i = 0; i < count && result == 0; i++)
+    {
+        uint32_t target_inode_index = targets[i]->inode;
+        struct inode *target_inode = &INODE_TABLE[target_inode_index];
+        struct inode_hot *target_hot = &INODE_HOT[target_inode_index];
+        int64_t bytes = usage_bytes(target_inode_index);
+        int32_t files = target_hot->is_directory ? target_hot->file_count : 1;
+
+        if (target_hot->is_directory)
+        {
+            result = remove_directory_tree(target_inode_index);
+        }
+        else
+        {
+            result = release_file_blocks(target_inode);
+            if (result == 0)
+            {
+                free_inode(target_inode_index);
+            }
+        }
+
+        if (result == 0)
+        {
+            memset(targets[i], 0, sizeof(struct directory_entry));
+            batch.dirty[target_dp[i]] = 1;
+            dir_slot_freed(batch.inode_index, target_dp[i] * DIRENTS_PER_BLOCK +
+                                                  (targets[i] - batch.blocks[target_dp[i]]->directory_entries));
+            removed_bytes += bytes;
+            removed_files += files;
+        }
+    }
+
+    // Entries removed so far are written back even if a later one failed.
+    if (store_dir_batch(&batch) < 0)
+        result = -1;
+
+    propagate_usage(batch.inode_index, -removed_bytes, -removed_files);
+    FS_LOG(FS_LOG_DEBUG, "event=remove_batch parent='%s' count=%zu", parent, count);
+
+out:
+    free_dir_batch(&batch);
+    free(sorted);
+    free(targets);
+    free(target_dp);
+    return result;
+}
+
+int fs_remove_batch(const char *parent, const char *const *names, size_t count)
+{
+    uint64_t start = stats_now_ns();
+    trace_depth++;
+    int result = count == 0 ? 0 : remove_batch(parent, names, count);
+    trace_depth--;
+    stats_record_op(FS_OP_REMOVE, start, result);
+    trace_batch(TRACE_REMOVE, parent, names, count, start, result);
+    return result;
+}
+
+struct fs_dir *fs_opendir(const char *path)
+{
+    if (!MOUNT_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
+        return NULL;
+    }
+
+    if (!path || path[0] != '/')
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Path must be absolute and start with '/'.");
+        return NULL;
+    }
+
+    uint32_t inode_index;
+    if (resolve_path(path, &inode_index) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' not found.", path);
+        return NULL;
+    }
+
+    if (!INODE_HOT[inode_index].is_directory)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' is not a directory.", path);
+        return NULL;
+    }
+
+    struct fs_dir *dir = slab_alloc(FS_SLAB_DIR_HANDLE);
+    union block *cached_block = slab_alloc(FS_SLAB_BLOCK);
+    if (!dir || !cached_block)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to allocate directory handle.");
+        slab_free(FS_SLAB_DIR_HANDLE, dir);
+        slab_free(FS_SLAB_BLOCK, cached_block);
+        return NULL;
+    }
+
+    dir->inode_index = inode_index;
+    dir->block_index = 0;
+    dir->slot = 0;
+    dir->cached_block_num = 0;
+    dir->cached_block = cached_block;
+    return dir;
+}
+
+/**
+ * Fills up to `max` entries from the cursor onwards into `entries` and, when
+ * given, `plus`. Each directory block is read at most once per call. The copy
+ * is dropped before returning, since the block may be rewritten in place
+ * before the next call.
+ *
+ * @return The number of entries returned, 0 at the end of the directory, -1 on error.
+ */
+static int read_dir_entries(struct fs_dir *dir, struct fs_dirent *entries, struct fs_dirent_plus *plus, size_t max)
+{
+    if (!MOUNT_FLAG || !dir)
+    {
+        return -1;
+    }
+
+    struct inode *dir_inode = &INODE_TABLE[dir->inode_index];
+    if (!BITMAP_TEST(INODE_BITMAP.bitmap, dir->inode_index) || !INODE_HOT[dir->inode_index].is_directory)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Directory was removed.");
+        return -1;
+    }
+
+    size_t count = 0;
+
+    while (count < max && dir->block_index < INODE_DIRECT_POINTERS)
+    {
+        uint32_t block_num = dir_inode->i_direct_pointers[dir->block_index];
+        if (block_num == 0 || dir->slot >= DIRENTS_PER_BLOCK)
+        {
+            dir->block_index++;
+            dir->slot = 0;
+            continue;
+        }
+
+        if (dir->cached_block_num != block_num)
+        {
+            if (read_block(DISK_TAG_DIRECTORY, block_num, dir->cached_block) < 0)
+            {
+                FS_LOG(FS_LOG_ERROR, "Error: Failed to read directory data.");
+                return -1;
+            }
+            dir->cached_block_num = block_num;
+        }
+
+        struct directory_entry *dir_entry = &dir->cached_block->directory_entries[dir->slot++];
+        if (dir_entry->inode == 0)
+        {
+            continue;
+        }
+
+        dir_entry->name[MAX_NAME_LEN - 1] = '\0';
+        if (strcmp(dir_entry->name, ".") == 0 || strcmp(dir_entry->name, "..") == 0)
+        {
+            continue;
+        }
+
+        struct inode_hot *entry_hot = &INODE_HOT[dir_entry->inode];
+        struct fs_dirent *out = plus ? &plus[count].entry : &entries[count];
+
+        out->inode = dir_entry->inode;
+        out->is_directory = entry_hot->is_directory;
+        out->size = usage_bytes(dir_entry->inode);
+        memcpy(out->name, dir_entry->name, MAX_NAME_LEN);
+
+        if (plus)
+        {
+            struct inode *entry_inode = &INODE_TABLE[dir_entry->inode];
+            struct fs_attr *attr = &plus[count].attr;
+            attr->parent = entry_hot->parent;
+            attr->file_count = entry_hot->is_directory ? entry_hot->file_count : 1;
+            attr->direct_blocks = 0;
+            for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+            {
+                if (holds_block(entry_inode->i_direct_pointers[dp]))
+                    attr->direct_blocks++;
+            }
+            attr->has_indirect = entry_inode->i_indirect_pointer != 0;
+        }
+
+        count++;
+    }
+
+    dir->cached_block_num = 0;
+    return count;
+}
+
+int fs_readdir(struct fs_dir *dir, struct fs_dirent *entries, size_t max)
+{
+    if (!entries)
+        return -1;
+
+    return read_dir_entries(dir, entries, NULL, max);
+}
+
+int fs_readdir_plus(struct fs_dir *dir, struct fs_dirent_plus *entries, size_t max)
+{
+    if (!entries)
+        return -1;
+
+    return read_dir_entries(dir, NULL, entries, max);
+}
+
+uint64_t fs_telldir(struct fs_dir *dir)
+{
+    if (!dir)
+        return 0;
+
+    return (uint64_t)dir->block_index * DIRENTS_PER_BLOCK + dir->slot;
+}
+
+void fs_seekdir(struct fs_dir *dir, uint64_t cookie)
+{
+    if (!dir)
+        return;
+
+    dir->block_index = cookie / DIRENTS_PER_BLOCK;
+    dir->slot = cookie % DIRENTS_PER_BLOCK;
+}
+
+void fs_closedir(struct fs_dir *dir)
+{
+    if (!dir)
+        return;
+
+    slab_free(FS_SLAB_BLOCK, dir->cached_block);
+    slab_free(FS_SLAB_DIR_HANDLE, dir);
+}
+
+int fs_list(const char *path)
+{
+    if (!MOUNT_FLAG)
+    {
+        return -1;
+    }
+
+    if (!path || path[0] != '/')
+    {
+        return -1;
+    }
+
+    uint32_t inode_index;
+    if (resolve_path(path, &inode_index) < 0)
+    {
+        return -1;
+    }
+
+    if (!INODE_HOT[inode_index].is_directory)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' is not a directory.", path);
+        return -1;
+    }
+
+    union block cached_block;
+    struct fs_dir dir = {0};
+    dir.inode_index = inode_index;
+    dir.cached_block = &cached_block;
+
+    struct fs_dirent entries[16];
+    int count;
+
+    while ((count = fs_readdir(&dir, entries, 16)) > 0)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            printf("%s %llu\n", entries[i].name, (unsigned long long)entries[i].size);
+        }
+    }
+
+    return count < 0 ? -1 : 0;
+}
+
+/**
+ * Resolves `path` to a regular file for writing, creating the file and any
+ * missing parent directories on the way.
+ *
+ * @return 0 on success (and *inode_index is set), -1 on error.
+ */
+static int open_file_for_write(const char *path, uint32_t *inode_index)
+{
+    char path_copy[256];
+    strncpy(path_copy, path, sizeof(path_copy));
+    path_copy[sizeof(path_copy) - 1] = '\0';
+
+    char *token;
+    char *rest = NULL;
+    uint32_t parent_inode_index = ROOT_DIR_INODE;
+    uint32_t file_inode_index = 0;
+    char name[MAX_NAME_LEN];
+
+    struct inode *parent_inode = NULL;
+    struct inode *file_inode = NULL;
+
+    char current_path[256] = "/";
+
+    while ((token = strtok_r(rest ? NULL : path_copy, "/", &rest)))
+    {
+        strncpy(name, token, MAX_NAME_LEN);
+        name[MAX_NAME_LEN - 1] = '\0';
+
+        if (strcmp(current_path, "/") == 0)
+            snprintf(current_path + strlen(current_path), sizeof(current_path) - strlen(current_path), "%s", name);
+        else
+            snprintf(current_path + strlen(current_path), sizeof(current_path) - strlen(current_path), "/%s", name);
+
+        parent_inode = &INODE_TABLE[parent_inode_index];
+
+        if (!INODE_HOT[parent_inode_index].is_directory)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: '%s' is not a directory.", name);
+            return -1;
+        }
+
+        uint32_t inode_index = 0;
+        int found = lookup_entry(parent_inode, name, &inode_index);
+        if (found < 0)
+            return -1;
+
+        if (rest == NULL || *rest == '\0')
+        {
+
+            if (found)
+            {
+                file_inode_index = inode_index;
+                file_inode = &INODE_TABLE[file_inode_index];
+                if (INODE_HOT[file_inode_index].is_directory)
+                {
+                    FS_LOG(FS_LOG_ERROR, "Error: '%s' is a directory.", path);
+                    return -1;
+                }
+            }
+            else
+            {
+
+                if (fs_create(current_path, 0) == -1)
+                {
+                    FS_LOG(FS_LOG_ERROR, "Error: Could not create file: %s", current_path);
+                    return -1;
+                }
+
+                parent_inode = &INODE_TABLE[parent_inode_index];
+
+                found = lookup_entry(parent_inode, name, &file_inode_index);
+                file_inode = found == 1 ? &INODE_TABLE[file_inode_index] : NULL;
+
+                if (found != 1)
+                {
+                    FS_LOG(FS_LOG_ERROR, "Error: Failed to locate newly created file.");
+                    return -1;
+                }
+            }
+        }
+        else
+        {
+
+            if (!found)
+            {
+
+                if (fs_create(current_path, 1) == -1)
+                {
+                    FS_LOG(FS_LOG_ERROR, "Error: Could not create directory: '%s'.", current_path);
+                    return -1;
+                }
+
+                parent_inode = &INODE_TABLE[parent_inode_index];
+
+                found = lookup_entry(parent_inode, name, &inode_index);
+
+                if (found != 1)
+                {
+                    FS_LOG(FS_LOG_ERROR, "Error: Failed to locate newly created directory.");
+                    return -1;
+                }
+            }
+
+            parent_inode_index = inode_index;
+        }
+    }
+
+    if (file_inode == NULL)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: File inode is NULL.");
+        return -1;
+    }
+
+    *inode_index = file_inode_index;
+    return 0;
+}
+
+/**
+ * Returns the slots mapping the blocks of cluster `cluster_index`. Slots in
+ * an indirect block that does not exist yet read as holes.
+ *
+ * @return 0 on success, -1 on I/O error.
+ */
+static int get_cluster_slots(struct inode *file_inode, size_t cluster_index, uint32_t slots[FS_CLUSTER_BLOCKS])
+{
+    union block *indirect_block = NULL;
+
+    for (int i = 0; i < FS_CLUSTER_BLOCKS; i++)
+    {
+        size_t block_index = cluster_index * FS_CLUSTER_BLOCKS + i;
+        slots[i] = 0;
+
+        if (block_index >= INODE_DIRECT_POINTERS + MAX_POINTERS ||
+            (block_index >= INODE_DIRECT_POINTERS && file_inode->i_indirect_pointer == 0))
+            continue;
+
+        if (block_index >= INODE_DIRECT_POINTERS && !indirect_block)
+        {
+            indirect_block = get_indirect_block(file_inode->i_indirect_pointer, 0);
+            if (!indirect_block)
+            {
+                FS_LOG(FS_LOG_ERROR, "Error: Failed to read indirect block.");
+                return -1;
+            }
+        }
+
+        slots[i] = *file_block_slot(file_inode, indirect_block, block_index);
+    }
+
+    return 0;
+}
+
+/**
+ * Decompresses the cluster stored in `slots`, unless it is the one already in
+ * CLUSTER_CACHE. A stored cluster starts with its compressed length.
+ */
+static int load_compressed_cluster(const uint32_t slots[FS_CLUSTER_BLOCKS])
+{
+    stats_record_cache(FS_CACHE_CLUSTER, cluster_cache_block == slots[0]);
+    if (cluster_cache_block == slots[0])
+        return 0;
+
+    _Alignas(BLOCK_SIZE) uint8_t packed[FS_CLUSTER_SIZE];
+    int stored_blocks = 0;
+
+    while (stored_blocks < FS_CLUSTER_BLOCKS && holds_block(slots[stored_blocks]))
+    {
+        if (read_block(DISK_TAG_DATA, slots[stored_blocks], packed + stored_blocks * BLOCK_SIZE) < 0)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to read data block.");
+            return -1;
+        }
+        stored_blocks++;
+    }
+
+    uint32_t packed_len;
+    memcpy(&packed_len, packed, sizeof(packed_len));
+
+    if (stored_blocks == 0 || packed_len > stored_blocks * BLOCK_SIZE - sizeof(packed_len) ||
+        lz_decompress(packed + sizeof(packed_len), packed_len, CLUSTER_CACHE, FS_CLUSTER_SIZE) != FS_CLUSTER_SIZE)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Corrupt compressed cluster at block %u.", slots[0]);
+        cluster_cache_block = 0;
+        return -1;
+    }
+
+    cluster_cache_block = slots[0];
+    return 0;
+}
+
+/**
+ * Stores one cluster of a compressed file into the slots that map it. The
+ * cluster takes as many blocks as its compressed form needs, and the slots
+ * left over hold FS_PTR_COMPRESSED. If compression does not save at least a
+ * block, the cluster is stored as plain blocks. All-zero blocks of a plain
+ * cluster, and an all-zero cluster as a whole, stay holes.
+ *
+ * The new blocks are allocated and written before any slot changes, and the
+ * blocks the slots held before are released only then. On failure the new
+ * blocks are released again and the slots are left as they were.
+ */
+static int store_cluster(uint32_t *slots[FS_CLUSTER_BLOCKS], const uint8_t *cluster)
+{
+    _Alignas(BLOCK_SIZE) uint8_t packed[FS_CLUSTER_SIZE];
+    uint32_t packed_len = lz_compress(cluster, FS_CLUSTER_SIZE, packed + sizeof(packed_len),
+                                      (FS_CLUSTER_BLOCKS - 1) * BLOCK_SIZE - sizeof(packed_len));
+    int stored_blocks = FS_CLUSTER_BLOCKS;
+    int compressed = packed_len > 0;
+
+    if (compressed)
+    {
+        memcpy(packed, &packed_len, sizeof(packed_len));
+        stored_blocks = (sizeof(packed_len) + packed_len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    }
+
+    int all_zero = 1;
+    for (int i = 0; i < FS_CLUSTER_BLOCKS && all_zero; i++)
+    {
+        all_zero = block_is_zero((const union block *)(cluster + i * BLOCK_SIZE));
+    }
+
+    uint32_t new_slots[FS_CLUSTER_BLOCKS];
+    int i;
+    for (i = 0; i < FS_CLUSTER_BLOCKS; i++)
+    {
+        const uint8_t *source = compressed ? packed + i * BLOCK_SIZE : cluster + i * BLOCK_SIZE;
+
+        if (all_zero || (!compressed && block_is_zero((const union block *)source)))
+        {
+            new_slots[i] = 0;
+            continue;
+        }
+
+        if (i >= stored_blocks)
+        {
+            new_slots[i] = FS_PTR_COMPRESSED;
+            continue;
+        }
+
+        new_slots[i] = allocate_data_block();
+        if (new_slots[i] == (uint32_t)-1)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: No available data blocks.");
+            break;
+        }
+
+        if (write_block(DISK_TAG_DATA, new_slots[i], (void *)source) < 0)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to write data block.");
+            release_data_block(new_slots[i]);
+            break;
+        }
+    }
+
+    if (i < FS_CLUSTER_BLOCKS)
+    {
+        while (i-- > 0)
+        {
+            if (holds_block(new_slots[i]))
+                release_data_block(new_slots[i]);
+        }
+        return -1;
+    }
+
+    for (i = 0; i < FS_CLUSTER_BLOCKS; i++)
+    {
+        uint32_t old_block_num = *slots[i];
+        *slots[i] = new_slots[i];
+        if (holds_block(old_block_num))
+            release_data_block(old_block_num);
+    }
+
+    return 0;
+}
+
+/**
+ * The write path for compressed files: each touched cluster is read back
+ * (decompressing it if needed), patched, and stored again in new blocks.
+ */
+static int write_compressed_data(uint32_t file_inode_index, const void *buf, size_t count, off_t offset)
+{
+    struct inode *file_inode = &INODE_TABLE[file_inode_index];
+    size_t remaining_bytes = count;
+    const char *write_buf = (const char *)buf;
+
+    while (remaining_bytes > 0)
+    {
+        size_t cluster_index = offset / FS_CLUSTER_SIZE;
+        size_t cluster_offset = offset % FS_CLUSTER_SIZE;
+        size_t first_block = cluster_index * FS_CLUSTER_BLOCKS;
+        size_t bytes_to_write = FS_CLUSTER_SIZE - cluster_offset;
+        if (bytes_to_write > remaining_bytes)
+            bytes_to_write = remaining_bytes;
+
+        if (first_block + FS_CLUSTER_BLOCKS > INODE_DIRECT_POINTERS + MAX_POINTERS)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: File size exceeds maximum supported size.");
+            return -1;
+        }
+
+        union block *indirect_block = NULL;
+        if (first_block + FS_CLUSTER_BLOCKS > INODE_DIRECT_POINTERS)
+        {
+            int fresh_indirect = 0;
+            if (file_inode->i_indirect_pointer == 0)
+            {
+                uint32_t indirect_block_index = allocate_data_block();
+                if (indirect_block_index == (uint32_t)-1)
+                {
+                    FS_LOG(FS_LOG_ERROR, "Error: No available data blocks for indirect pointer.");
+                    return -1;
+                }
+                file_inode->i_indirect_pointer = indirect_block_index;
+                fresh_indirect = 1;
+            }
+            else if (unshare_indirect_block(file_inode) < 0)
+            {
+                return -1;
+            }
+
+            indirect_block = get_indirect_block(file_inode->i_indirect_pointer, fresh_indirect);
+            if (!indirect_block)
+            {
+                FS_LOG(FS_LOG_ERROR, "Error: Failed to read indirect block.");
+                return -1;
+            }
+        }
+
+        uint32_t *slots[FS_CLUSTER_BLOCKS];
+        uint32_t old_slots[FS_CLUSTER_BLOCKS];
+        for (int i = 0; i < FS_CLUSTER_BLOCKS; i++)
+        {
+            slots[i] = file_block_slot(file_inode, indirect_block, first_block + i);
+            old_slots[i] = *slots[i];
+        }
+
+        // A cluster that is overwritten as a whole needs no read.
+        _Alignas(BLOCK_SIZE) uint8_t cluster[FS_CLUSTER_SIZE];
+        if (bytes_to_write < FS_CLUSTER_SIZE && old_slots[FS_CLUSTER_BLOCKS - 1] == FS_PTR_COMPRESSED)
+        {
+            if (load_compressed_cluster(old_slots) < 0)
+                return -1;
+            memcpy(cluster, CLUSTER_CACHE, FS_CLUSTER_SIZE);
+        }
+        else if (bytes_to_write < FS_CLUSTER_SIZE)
+        {
+            for (int i = 0; i < FS_CLUSTER_BLOCKS; i++)
+            {
+                uint8_t *block_data = cluster + i * BLOCK_SIZE;
+                if (old_slots[i] == 0 || BITMAP_TEST(UNWRITTEN_BITMAP.bitmap, old_slots[i]))
+                {
+                    memset(block_data, 0, BLOCK_SIZE);
+                }
+                else if (read_block(DISK_TAG_DATA, old_slots[i], block_data) < 0)
+                {
+                    FS_LOG(FS_LOG_ERROR, "Error: Failed to read data block.");
+                    return -1;
+                }
+            }
+        }
+
+        memcpy(cluster + cluster_offset, write_buf, bytes_to_write);
+
+        int result = store_cluster(slots, cluster);
+
+        if (indirect_block &&
+            write_block(DISK_TAG_INDIRECT, file_inode->i_indirect_pointer, indirect_block) < 0)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to update indirect block.");
+            invalidate_indirect_block(file_inode->i_indirect_pointer);
+            return -1;
+        }
+
+        if (result < 0)
+            return -1;
+
+        offset += bytes_to_write;
+        write_buf += bytes_to_write;
+        remaining_bytes -= bytes_to_write;
+    }
+
+    struct inode_hot *file_hot = &INODE_HOT[file_inode_index];
+    if ((size_t)offset > file_hot->size)
+    {
+        propagate_usage(file_hot->parent, (size_t)offset - file_hot->size, 0);
+        file_hot->size = offset;
+    }
+
+    return 0;
+}
+
+/**
+ * Writes `count` bytes at `offset`, allocating only the blocks the range
+ * touches. Skipped-over blocks stay holes.
+ */
+static int write_file_data(uint32_t file_inode_index, const void *buf, size_t count, off_t offset)
+{
+    struct inode *file_inode = &INODE_TABLE[file_inode_index];
+    size_t remaining_bytes = count;
+    const char *write_buf = (const char *)buf;
+
+    if (INODE_HOT[file_inode_index].flags & FS_INODE_COMPRESSED)
+        return write_compressed_data(file_inode_index, buf, count, offset);
+
+    while (remaining_bytes > 0)
+    {
+        size_t block_index = offset / BLOCK_SIZE;
+        size_t block_offset = offset % BLOCK_SIZE;
+        union block *indirect_block = NULL;
+        int fresh_indirect = 0;
+
+        if (block_index >= INODE_DIRECT_POINTERS)
+        {
+            if (block_index - INODE_DIRECT_POINTERS >= MAX_POINTERS)
+            {
+                FS_LOG(FS_LOG_ERROR, "Error: File size exceeds maximum supported size.");
+                return -1;
+            }
+
+            if (file_inode->i_indirect_pointer == 0)
+            {
+                uint32_t indirect_block_index = allocate_data_block();
+                if (indirect_block_index == (uint32_t)-1)
+                {
+                    FS_LOG(FS_LOG_ERROR, "Error: No available data blocks for indirect pointer.");
+                    return -1;
+                }
+                file_inode->i_indirect_pointer = indirect_block_index;
+                fresh_indirect = 1;
+            }
+            else if (unshare_indirect_block(file_inode) < 0)
+            {
+                return -1;
+            }
+
+            indirect_block = get_indirect_block(file_inode->i_indirect_pointer, fresh_indirect);
+            if (!indirect_block)
+            {
+                FS_LOG(FS_LOG_ERROR, "Error: Failed to read indirect block.");
+                return -1;
+            }
+        }
+
+        uint32_t *slot = file_block_slot(file_inode, indirect_block, block_index);
+        uint32_t previous_block_num = *slot;
+
+        size_t writable_bytes = BLOCK_SIZE - block_offset;
+        size_t bytes_to_write = (remaining_bytes < writable_bytes) ? remaining_bytes : writable_bytes;
+
+        // Holes and unwritten blocks read as zeros, and a full-block write
+        // overwrites everything: none of them need a read.
+        union block data_block;
+        if (*slot == 0 || BITMAP_TEST(UNWRITTEN_BITMAP.bitmap, *slot))
+        {
+            memset(&data_block, 0, sizeof(data_block));
+        }
+        else if (bytes_to_write < BLOCK_SIZE && read_block(DISK_TAG_DATA, *slot, &data_block) < 0)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to read data block.");
+            return -1;
+        }
+
+        memcpy(data_block.data + block_offset, write_buf, bytes_to_write);
+
+        uint64_t hash = 0;
+        int deduplicated = DEDUP_FLAG ? dedup_block(slot, &data_block, &hash) : 0;
+        if (deduplicated < 0)
+        {
+            return -1;
+        }
+
+        if (!deduplicated)
+        {
+            if (*slot == 0)
+            {
+                uint32_t data_block_index = allocate_data_block();
+                if (data_block_index == (uint32_t)-1)
+                {
+                    FS_LOG(FS_LOG_ERROR, "Error: No available data blocks.");
+                    return -1;
+                }
+                *slot = data_block_index;
+            }
+            else if (!block_is_shared(*slot))
+            {
+                dedup_forget(*slot);
+            }
+
+            if (write_block_cow(DISK_TAG_DATA, slot, &data_block) < 0)
+            {
+                FS_LOG(FS_LOG_ERROR, "Error: Failed to write data block.");
+                return -1;
+            }
+            BITMAP_CLEAR(UNWRITTEN_BITMAP.bitmap, *slot);
+
+            if (hash != 0)
+                dedup_remember(*slot, hash);
+        }
+
+        // A new indirect block exists only in the cache until it is written,
+        // even when this write left its slot a hole.
+        if (indirect_block && (fresh_indirect || *slot != previous_block_num) &&
+            write_block(DISK_TAG_INDIRECT, file_inode->i_indirect_pointer, indirect_block) < 0)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to update indirect block.");
+            invalidate_indirect_block(file_inode->i_indirect_pointer);
+            return -1;
+        }
+
+        offset += bytes_to_write;
+        write_buf += bytes_to_write;
+        remaining_bytes -= bytes_to_write;
+    }
+
+    struct inode_hot *file_hot = &INODE_HOT[file_inode_index];
+    if ((size_t)offset > file_hot->size)
+    {
+        propagate_usage(file_hot->parent, (size_t)offset - file_hot->size, 0);
+        file_hot->size = offset;
+    }
+
+    return 0;
+}
+
+static const uint8_t ZERO_CLUSTER[FS_CLUSTER_SIZE];
+
+/**
+ * Sets the size of a regular file. Growing leaves a hole. Shrinking releases
+ * every block past the new end in one pass over the block map, including the
+ * indirect block once none of its entries is needed, and zeroes the rest of
+ * a partly kept block (a cluster, for a compressed file) so that it still
+ * reads as zeros if the file grows again.
+ */
+static int truncate_file(uint32_t file_inode_index, size_t size)
+{
+    struct inode *file_inode = &INODE_TABLE[file_inode_index];
+    struct inode_hot *file_hot = &INODE_HOT[file_inode_index];
+    size_t old_size = file_hot->size;
+    int compressed = (file_hot->flags & FS_INODE_COMPRESSED) != 0;
+    size_t unit = compressed ? FS_CLUSTER_SIZE : BLOCK_SIZE;
+
+    if (size > (size_t)(INODE_DIRECT_POINTERS + MAX_POINTERS) * BLOCK_SIZE)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: File size exceeds maximum supported size.");
+        return -1;
+    }
+
+    if (size < old_size && size % unit != 0)
+    {
+        size_t block_index = size / BLOCK_SIZE;
+        uint32_t slots[FS_CLUSTER_BLOCKS];
+        if (get_cluster_slots(file_inode, block_index / FS_CLUSTER_BLOCKS, slots) < 0)
+            return -1;
+
+        // Holes and unwritten blocks already read as zeros.
+        int stored = 0;
+        for (int i = 0; i < FS_CLUSTER_BLOCKS; i++)
+        {
+            if (compressed || i == (int)(block_index % FS_CLUSTER_BLOCKS))
+                stored |= holds_block(slots[i]) && !BITMAP_TEST(UNWRITTEN_BITMAP.bitmap, slots[i]);
+        }
+
+        size_t tail_bytes = unit - size % unit;
+        if (tail_bytes > old_size - size)
+            tail_bytes = old_size - size;
+
+        if (stored && write_file_data(file_inode_index, ZERO_CLUSTER, tail_bytes, size) < 0)
+            return -1;
+    }
+
+    if (size < old_size)
+    {
+        size_t keep_blocks = (size + unit - 1) / unit * (unit / BLOCK_SIZE);
+
+        for (size_t dp = keep_blocks; dp < INODE_DIRECT_POINTERS; dp++)
+        {
+            if (holds_block(file_inode->i_direct_pointers[dp]))
+                release_data_block(file_inode->i_direct_pointers[dp]);
+            file_inode->i_direct_pointers[dp] = 0;
+        }
+
+        if (keep_blocks <= INODE_DIRECT_POINTERS)
+        {
+            if (release_indirect_block(file_inode) < 0)
+                return -1;
+        }
+        else if (file_inode->i_indirect_pointer != 0)
+        {
+            if (unshare_indirect_block(file_inode) < 0)
+                return -1;
+
+            union block *indirect_block = get_indirect_block(file_inode->i_indirect_pointer, 0);
+            if (!indirect_block)
+            {
+                FS_LOG(FS_LOG_ERROR, "Error: Failed to read indirect block.");
+                return -1;
+            }
+
+            int dirty = 0;
+            for (size_t i = keep_blocks - INODE_DIRECT_POINTERS; i < MAX_POINTERS; i++)
+            {
+                if (indirect_block->pointers[i] == 0)
+                    continue;
+
+                if (holds_block(indirect_block->pointers[i]))
+                    release_data_block(indirect_block->pointers[i]);
+                indirect_block->pointers[i] = 0;
+                dirty = 1;
+            }
+
+            if (dirty && write_block(DISK_TAG_INDIRECT, file_inode->i_indirect_pointer, indirect_block) < 0)
+            {
+                FS_LOG(FS_LOG_ERROR, "Error: Failed to update indirect block.");
+                invalidate_indirect_block(file_inode->i_indirect_pointer);
+                return -1;
+            }
+        }
+    }
+
+    propagate_usage(file_hot->parent, (int64_t)size - (int64_t)old_size, 0);
+    file_hot->size = size;
+    return 0;
+}
+
+static int write_path(const char *path, const void *buf, size_t count, int append)
+{
+    if (!MOUNT_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
+        return -1;
+    }
+
+    if (READONLY_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem is mounted read-only.");
+        return -1;
+    }
+
+    if (!path || path[0] != '/')
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Path must be absolute and start with '/'.");
+        return -1;
+    }
+
+    if (!buf || count == 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Invalid buffer or count.");
+        return -1;
+    }
+
+    uint32_t file_inode_index;
+    if (open_file_for_write(path, &file_inode_index) < 0)
+    {
+        return -1;
+    }
+
+    // A rewrite drops whatever lies past its end. Cutting back to a block
+    // (or cluster) boundary first lets the last partial block be written
+    // fresh instead of read, patched and then zeroed.
+    struct inode_hot *file_hot = &INODE_HOT[file_inode_index];
+    if (!append && file_hot->size > count)
+    {
+        size_t unit = (file_hot->flags & FS_INODE_COMPRESSED) ? FS_CLUSTER_SIZE : BLOCK_SIZE;
+        if (truncate_file(file_inode_index, count - count % unit) < 0)
+            return -1;
+    }
+
+    off_t offset = append ? file_hot->size : 0;
+    if (write_file_data(file_inode_index, buf, count, offset) < 0)
+    {
+        return -1;
+    }
+
+    FS_LOG(FS_LOG_DEBUG, "event=write path='%s' bytes=%zu", path, count);
+    return 0;
+}
+
+int fs_write(const char *path, const void *buf, size_t count, int append)
+{
+    uint64_t start = stats_now_ns();
+    trace_depth++;
+    int result = write_path(path, buf, count, append);
+    trace_depth--;
+    stats_record_op(FS_OP_WRITE, start, result);
+    TRACE_OP(append ? TRACE_APPEND : TRACE_WRITE, path, 0, count, start, result);
+    return result;
+}
+
+static int pwrite_path(const char *path, const void *buf, size_t count, off_t offset)
+{
+    if (!MOUNT_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
+        return -1;
+    }
+
+    if (READONLY_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem is mounted read-only.");
+        return -1;
+    }
+
+    if (!path || path[0] != '/')
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Path must be absolute and start with '/'.");
+        return -1;
+    }
+
+    if (!buf || count == 0 || offset < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Invalid buffer, count or offset.");
+        return -1;
+    }
+
+    uint32_t file_inode_index;
+    if (open_file_for_write(path, &file_inode_index) < 0)
+    {
+        return -1;
+    }
+
+    if (write_file_data(file_inode_index, buf, count, offset) < 0)
+    {
+        return -1;
+    }
+
+    return count;
+}
+
+int fs_pwrite(const char *path, const void *buf, size_t count, off_t offset)
+{
+    uint64_t start = stats_now_ns();
+    trace_depth++;
+    int result = pwrite_path(path, buf, count, offset);
+    trace_depth--;
+    stats_record_op(FS_OP_WRITE, start, result);
+    TRACE_OP(TRACE_PWRITE, path, offset, count, start, result);
+    return result;
+}
+
+static int truncate_path(const char *path, off_t size)
+{
+    if (!MOUNT_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
+        return -1;
+    }
+
+    if (READONLY_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem is mounted read-only.");
+        return -1;
+    }
+
+    if (!path || path[0] != '/')
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Path must be absolute and start with '/'.");
+        return -1;
+    }
+
+    if (size < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Invalid size.");
+        return -1;
+    }
+
+    uint32_t file_inode_index;
+    if (resolve_path(path, &file_inode_index) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' not found.", path);
+        return -1;
+    }
+
+    if (INODE_HOT[file_inode_index].is_directory)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' is a directory.", path);
+        return -1;
+    }
+
+    if (truncate_file(file_inode_index, size) < 0)
+        return -1;
+
+    FS_LOG(FS_LOG_DEBUG, "event=truncate path='%s' size=%lld", path, (long long)size);
+    return 0;
+}
+
+int fs_truncate(const char *path, off_t size)
+{
+    uint64_t start = stats_now_ns();
+    trace_depth++;
+    int result = truncate_path(path, size);
+    trace_depth--;
+    stats_record_op(FS_OP_WRITE, start, result);
+    TRACE_OP(TRACE_TRUNCATE, path, size, 0, start, result);
+    return result;
+}
+
+static int read_path(const char *path, void *buf, size_t count, off_t offset)
+{
+    if (!MOUNT_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
+        return -1;
+    }
+
+    if (!path || path[0] != '/')
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Path must be absolute and start with '/'.");
+        return -1;
+    }
+
+    if (!buf || count == 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Invalid buffer or count.");
+        return -1;
+    }
+
+    uint32_t file_inode_index;
+    if (resolve_path(path, &file_inode_index) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' not found.", path);
+        return -1;
+    }
+
+    struct inode *file_inode = &INODE_TABLE[file_inode_index];
+    struct inode_hot *file_hot = &INODE_HOT[file_inode_index];
+
+    if (file_hot->is_directory)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' is a directory.", path);
+        return -1;
+    }
+
+    if ((size_t)offset >= file_hot->size)
+    {
+        FS_LOG(FS_LOG_DEBUG, "event=read path='%s' bytes=0 eof=1", path);
+        return 0;
+    }
+
+    if (offset + count > file_hot->size)
+    {
+        count = file_hot->size - offset;
+    }
+
+    size_t remaining_bytes = count;
+    char *read_buf = (char *)buf;
+    size_t total_read = 0;
+
+    while (remaining_bytes > 0)
+    {
+        size_t block_index = offset / BLOCK_SIZE;
+        size_t block_offset = offset % BLOCK_SIZE;
+
+        if (file_hot->flags & FS_INODE_COMPRESSED)
+        {
+            uint32_t slots[FS_CLUSTER_BLOCKS];
+            if (get_cluster_slots(file_inode, offset / FS_CLUSTER_SIZE, slots) < 0)
+            {
+                return -1;
+            }
+
+            // Plain clusters of a compressed file are read block by block below.
+            if (slots[FS_CLUSTER_BLOCKS - 1] == FS_PTR_COMPRESSED)
+            {
+                if (load_compressed_cluster(slots) < 0)
+                {
+                    return -1;
+                }
+
+                size_t cluster_offset = offset % FS_CLUSTER_SIZE;
+                size_t bytes_to_read = FS_CLUSTER_SIZE - cluster_offset;
+                if (bytes_to_read > remaining_bytes)
+                    bytes_to_read = remaining_bytes;
+
+                memcpy(read_buf, CLUSTER_CACHE + cluster_offset, bytes_to_read);
+                read_buf += bytes_to_read;
+                offset += bytes_to_read;
+                remaining_bytes -= bytes_to_read;
+                total_read += bytes_to_read;
+                continue;
+            }
+        }
+
+        uint32_t data_block_num = 0;
+
+        if (block_index < INODE_DIRECT_POINTERS)
+        {
+            data_block_num = file_inode->i_direct_pointers[block_index];
+        }
+        else
+        {
+
+            block_index -= INODE_DIRECT_POINTERS;
+
+            if (block_index >= BLOCK_SIZE / sizeof(uint32_t))
+            {
+                FS_LOG(FS_LOG_ERROR, "Error: Block index out of bounds.");
+                return -1;
+            }
+
+            if (file_inode->i_indirect_pointer != 0)
+            {
+                union block *indirect_block = get_indirect_block(file_inode->i_indirect_pointer, 0);
+                if (!indirect_block)
+                {
+                    FS_LOG(FS_LOG_ERROR, "Error: Failed to read indirect block.");
+                    return -1;
+                }
+
+                data_block_num = indirect_block->pointers[block_index];
+            }
+        }
+
+        size_t readable_bytes = BLOCK_SIZE - block_offset;
+        size_t bytes_to_read = (remaining_bytes < readable_bytes) ? remaining_bytes : readable_bytes;
+
+        if (data_block_num == 0 || BITMAP_TEST(UNWRITTEN_BITMAP.bitmap, data_block_num))
+        {
+            memset(read_buf, 0, bytes_to_read);
+        }
+        else
+        {
+            union block data_block;
+            if (read_block(DISK_TAG_DATA, data_block_num, &data_block) < 0)
+            {
+                FS_LOG(FS_LOG_ERROR, "Error: Failed to read data block.");
+                return -1;
+            }
+
+            memcpy(read_buf, data_block.data + block_offset, bytes_to_read);
+        }
+
+        read_buf += bytes_to_read;
+        offset += bytes_to_read;
+        remaining_bytes -= bytes_to_read;
+        total_read += bytes_to_read;
+    }
+
+    FS_LOG(FS_LOG_DEBUG, "event=read path='%s' bytes=%zu", path, total_read);
+    return total_read;
+}
+
+int fs_read(const char *path, void *buf, size_t count, off_t offset)
+{
+    uint64_t start = stats_now_ns();
+    trace_depth++;
+    int result = read_path(path, buf, count, offset);
+    trace_depth--;
+    stats_record_op(FS_OP_READ, start, result);
+    TRACE_OP(TRACE_READ, path, offset, count, start, result);
+    return result;
+}
+
+off_t fs_seek(const char *path, off_t offset, int whence)
+{
+    if (!MOUNT_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
+        return -1;
+    }
+
+    if (!path || path[0] != '/')
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Path must be absolute and start with '/'.");
+        return -1;
+    }
+
+    if (whence != FS_SEEK_DATA && whence != FS_SEEK_HOLE)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Invalid seek mode.");
+        return -1;
+    }
+
+    uint32_t file_inode_index;
+    if (resolve_path(path, &file_inode_index) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' not found.", path);
+        return -1;
+    }
+
+    struct inode *file_inode = &INODE_TABLE[file_inode_index];
+    struct inode_hot *file_hot = &INODE_HOT[file_inode_index];
+    if (file_hot->is_directory)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' is a directory.", path);
+        return -1;
+    }
+
+    if (offset < 0 || (size_t)offset >= file_hot->size)
+    {
+        return -1;
+    }
+
+    size_t last_block = (file_hot->size - 1) / BLOCK_SIZE;
+
+    union block no_indirect_block = {0};
+    union block *indirect_block = &no_indirect_block;
+    if (last_block >= INODE_DIRECT_POINTERS && file_inode->i_indirect_pointer != 0)
+    {
+        indirect_block = get_indirect_block(file_inode->i_indirect_pointer, 0);
+        if (!indirect_block)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to read indirect block.");
+            return -1;
+        }
+    }
+
+    // Unwritten blocks read back as zeros, so they count as holes.
+    for (size_t block_index = offset / BLOCK_SIZE; block_index <= last_block; block_index++)
+    {
+        uint32_t data_block_num = *file_block_slot(file_inode, indirect_block, block_index);
+        int is_data = data_block_num == FS_PTR_COMPRESSED ||
+                      (data_block_num != 0 && !BITMAP_TEST(UNWRITTEN_BITMAP.bitmap, data_block_num));
+
+        if (is_data == (whence == FS_SEEK_DATA))
+        {
+            off_t position = (off_t)block_index * BLOCK_SIZE;
+            return position > offset ? position : offset;
+        }
+    }
+
+    // End of file is an implicit hole; there is no data past it.
+    return whence == FS_SEEK_HOLE ? (off_t)file_hot->size : -1;
+}
+
+static int fallocate_path(const char *path, off_t offset, off_t len)
+{
+    if (!MOUNT_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
+        return -1;
+    }
+
+    if (READONLY_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem is mounted read-only.");
+        return -1;
+    }
+
+    if (!path || path[0] != '/')
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Path must be absolute and start with '/'.");
+        return -1;
+    }
+
+    if (offset < 0 || len <= 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Invalid offset or length.");
+        return -1;
+    }
+
+    uint32_t file_inode_index;
+    if (resolve_path(path, &file_inode_index) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' not found.", path);
+        return -1;
+    }
+
+    struct inode *file_inode = &INODE_TABLE[file_inode_index];
+    struct inode_hot *file_hot = &INODE_HOT[file_inode_index];
+    if (file_hot->is_directory)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' is a directory.", path);
+        return -1;
+    }
+
+    if (file_hot->flags & FS_INODE_COMPRESSED)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Cannot preallocate a compressed file.");
+        return -1;
+    }
+
+    // Checked before computing the end of the range, which could overflow.
+    const off_t max_file_size = (off_t)(INODE_DIRECT_POINTERS + MAX_POINTERS) * BLOCK_SIZE;
+    if (offset > max_file_size || len > max_file_size - offset)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: File size exceeds maximum supported size.");
+        return -1;
+    }
+
+    size_t first_block = offset / BLOCK_SIZE;
+    size_t last_block = (offset + len - 1) / BLOCK_SIZE;
+
+    union block *indirect_block = NULL;
+    int indirect_dirty = 0;
+    int fresh_indirect = 0;
+
+    if (last_block >= INODE_DIRECT_POINTERS)
+    {
+        if (file_inode->i_indirect_pointer == 0)
+        {
+            uint32_t indirect_block_index = allocate_data_block();
+            if (indirect_block_index == (uint32_t)-1)
+            {
+                FS_LOG(FS_LOG_ERROR, "Error: No available data blocks for indirect pointer.");
+                return -1;
+            }
+            file_inode->i_indirect_pointer = indirect_block_index;
+            indirect_dirty = 1;
+            fresh_indirect = 1;
+        }
+        else if (unshare_indirect_block(file_inode) < 0)
+        {
+            return -1;
+        }
+
+        indirect_block = get_indirect_block(file_inode->i_indirect_pointer, fresh_indirect);
+        if (!indirect_block)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to read indirect block.");
+            return -1;
+        }
+    }
+
+    // Continue the layout right after the block preceding the range, if any.
+    uint32_t goal = 0;
+    if (first_block > 0)
+    {
+        uint32_t previous = *file_block_slot(file_inode, indirect_block, first_block - 1);
+        if (previous != 0)
+            goal = previous + 1;
+    }
+
+    // The slots this call fills, so a failure can give their blocks back.
+    uint8_t claimed[INODE_DIRECT_POINTERS + MAX_POINTERS] = {0};
+    int result = 0;
+    size_t block_index = first_block;
+
+    while (block_index <= last_block)
+    {
+        uint32_t *slot = file_block_slot(file_inode, indirect_block, block_index);
+        if (*slot != 0)
+        {
+            goal = *slot + 1;
+            block_index++;
+            continue;
+        }
+
+        size_t run = 1;
+        while (block_index + run <= last_block &&
+               *file_block_slot(file_inode, indirect_block, block_index + run) == 0)
+        {
+            run++;
+        }
+
+        uint32_t run_start;
+        uint32_t allocated = allocate_block_run(goal, run, &run_start);
+        if (allocated == 0)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: No available data blocks.");
+            result = -1;
+            break;
+        }
+
+        for (uint32_t i = 0; i < allocated; i++, block_index++)
+        {
+            *file_block_slot(file_inode, indirect_block, block_index) = run_start + i;
+            claimed[block_index] = 1;
+            BITMAP_SET(UNWRITTEN_BITMAP.bitmap, run_start + i);
+            if (block_index >= INODE_DIRECT_POINTERS)
+                indirect_dirty = 1;
+        }
+        goal = run_start + allocated;
+    }
+
+    if (result < 0)
+    {
+        // Give back everything this call allocated. The indirect block then
+        // lists what it listed before, so only a new one needs releasing.
+        for (size_t i = first_block; i < block_index; i++)
+        {
+            if (!claimed[i])
+                continue;
+
+            uint32_t *slot = file_block_slot(file_inode, indirect_block, i);
+            release_data_block(*slot);
+            *slot = 0;
+        }
+
+        if (fresh_indirect)
+        {
+            release_data_block(file_inode->i_indirect_pointer);
+            file_inode->i_indirect_pointer = 0;
+        }
+        return -1;
+    }
+
+    if (indirect_dirty && write_block(DISK_TAG_INDIRECT, file_inode->i_indirect_pointer, indirect_block) < 0)
+    {
+        invalidate_indirect_block(file_inode->i_indirect_pointer);
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to update indirect block.");
+        return -1;
+    }
+
+    if ((size_t)(offset + len) > file_hot->size)
+    {
+        propagate_usage(file_hot->parent, (size_t)(offset + len) - file_hot->size, 0);
+        file_hot->size = offset + len;
+    }
+
+    return 0;
+}
+
+int fs_fallocate(const char *path, off_t offset, off_t len)
+{
+    uint64_t start = stats_now_ns();
+    trace_depth++;
+    int result = fallocate_path(path, offset, len);
+    trace_depth--;
+    stats_record_op(FS_OP_WRITE, start, result);
+    TRACE_OP(TRACE_FALLOCATE, path, offset, len, start, result);
+    return result;
+}
+
+int fs_get_usage(const char *path, uint64_t *bytes, uint32_t *files)
+{
+    if (!MOUNT_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
+        return -1;
+    }
+
+    if (!path || path[0] != '/')
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Path must be absolute and start with '/'.");
+        return -1;
+    }
+
+    uint32_t inode_index;
+    if (resolve_path(path, &inode_index) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' not found.", path);
+        return -1;
+    }
+
+    struct inode_hot *hot = &INODE_HOT[inode_index];
+    if (bytes)
+        *bytes = usage_bytes(inode_index);
+    if (files)
+        *files = hot->is_directory ? hot->file_count : 1;
+
+    return 0;
+}
+
+void fs_set_discard(int enable)
+{
+    DISCARD_FLAG = enable ? 1 : 0;
+}
+
+void fs_set_dedup(int enable)
+{
+    DEDUP_FLAG = enable ? 1 : 0;
+}
+
+int fs_set_compression(const char *path, int enable)
+{
+    if (!MOUNT_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
+        return -1;
+    }
+
+    if (READONLY_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem is mounted read-only.");
+        return -1;
+    }
+
+    if (!path || path[0] != '/')
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Path must be absolute and start with '/'.");
+        return -1;
+    }
+
+    uint32_t inode_index;
+    if (resolve_path(path, &inode_index) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' not found.", path);
+        return -1;
+    }
+
+    struct inode_hot *hot = &INODE_HOT[inode_index];
+    if (hot->is_directory)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' is a directory.", path);
+        return -1;
+    }
+
+    // The block map of a file is either all plain or all clustered.
+    if (hot->size != 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Compression can only be changed on an empty file.");
+        return -1;
+    }
+
+    if (enable)
+        hot->flags |= FS_INODE_COMPRESSED;
+    else
+        hot->flags &= ~FS_INODE_COMPRESSED;
+
+    return 0;
+}
+
+static int clone_path(const char *src_path, const char *dst_path)
+{
+    if (!MOUNT_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
+        return -1;
+    }
+
+    if (READONLY_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem is mounted read-only.");
+        return -1;
+    }
+
+    if (!src_path || src_path[0] != '/' || !dst_path || dst_path[0] != '/')
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Path must be absolute and start with '/'.");
+        return -1;
+    }
+
+    uint32_t src_inode_index;
+    if (resolve_path(src_path, &src_inode_index) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' not found.", src_path);
+        return -1;
+    }
+
+    if (INODE_HOT[src_inode_index].is_directory)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' is a directory.", src_path);
+        return -1;
+    }
+
+    // The clone holds one more reference to each block in the source inode.
+    struct inode *src_inode = &INODE_TABLE[src_inode_index];
+    for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+    {
+        if (holds_block(src_inode->i_direct_pointers[dp]) && REFCOUNTS[src_inode->i_direct_pointers[dp]] == REFCOUNT_MAX)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Block reference count overflow.");
+            return -1;
+        }
+    }
+    if (src_inode->i_indirect_pointer != 0 && REFCOUNTS[src_inode->i_indirect_pointer] == REFCOUNT_MAX)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Block reference count overflow.");
+        return -1;
+    }
+
+    uint32_t dst_inode_index;
+    if (resolve_path(dst_path, &dst_inode_index) == 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: File or directory already exists.");
+        return -1;
+    }
+
+    if (ensure_refcount_table() < 0 || open_file_for_write(dst_path, &dst_inode_index) < 0)
+    {
+        return -1;
+    }
+
+    struct inode *dst_inode = &INODE_TABLE[dst_inode_index];
+    src_inode = &INODE_TABLE[src_inode_index];
+
+    memcpy(dst_inode->i_direct_pointers, src_inode->i_direct_pointers, sizeof(dst_inode->i_direct_pointers));
+    dst_inode->i_indirect_pointer = src_inode->i_indirect_pointer;
+    INODE_HOT[dst_inode_index].size = INODE_HOT[src_inode_index].size;
+    INODE_HOT[dst_inode_index].flags = INODE_HOT[src_inode_index].flags;
+
+    for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+    {
+        if (holds_block(dst_inode->i_direct_pointers[dp]))
+            REFCOUNTS[dst_inode->i_direct_pointers[dp]]++;
+    }
+    if (dst_inode->i_indirect_pointer != 0)
+        REFCOUNTS[dst_inode->i_indirect_pointer]++;
+
+    propagate_usage(INODE_HOT[dst_inode_index].parent, INODE_HOT[dst_inode_index].size, 0);
+    FS_LOG(FS_LOG_DEBUG, "event=clone src='%s' dst='%s' bytes=%u", src_path, dst_path, INODE_HOT[dst_inode_index].size);
+    return 0;
+}
+
+int fs_clone(const char *src_path, const char *dst_path)
+{
+    uint64_t start = stats_now_ns();
+    trace_depth++;
+    int result = clone_path(src_path, dst_path);
+    trace_depth--;
+    stats_record_op(FS_OP_CREATE, start, result);
+    TRACE_OP_PAIR(TRACE_CLONE, src_path, dst_path, start, result);
+    return result;
+}
+
+/**
+ * Points the ".." entry of directory `dir_inode_index` at its new parent. A
+ * child of the root stores 0 there, which reads as a free slot, so the slot
+ * may since have been reused; then there is no ".." to update.
+ */
+static int update_dotdot(uint32_t dir_inode_index, uint32_t parent_inode_index)
+{
+    struct inode *dir_inode = &INODE_TABLE[dir_inode_index];
+    union block data_block;
+
+    if (dir_inode->i_direct_pointers[0] == 0)
+        return 0;
+
+    if (read_block(DISK_TAG_DIRECTORY, dir_inode->i_direct_pointers[0], &data_block) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to read directory data.");
+        return -1;
+    }
+
+    struct directory_entry *dotdot = &data_block.directory_entries[1];
+    if (strncmp(dotdot->name, "..", MAX_NAME_LEN) != 0)
+        return 0;
+
+    uint32_t old_parent_inode_index = dotdot->inode;
+    dotdot->inode = parent_inode_index;
+    if (write_block_cow(DISK_TAG_DIRECTORY, &dir_inode->i_direct_pointers[0], &data_block) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to write directory data.");
+        return -1;
+    }
+
+    if (old_parent_inode_index == 0 && parent_inode_index != 0)
+        dir_slot_used(dir_inode_index, 1);
+    else if (old_parent_inode_index != 0 && parent_inode_index == 0)
+        dir_slot_freed(dir_inode_index, 1);
+    return 0;
+}
+
+static int rename_path(const char *old_path, const char *new_path)
+{
+    if (!MOUNT_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
+        return -1;
+    }
+
+    if (READONLY_FLAG)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem is mounted read-only.");
+        return -1;
+    }
+
+    if (!old_path || old_path[0] != '/' || !new_path || new_path[0] != '/')
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Path must be absolute and start with '/'.");
+        return -1;
+    }
+
+    uint32_t old_parent_inode_index, new_parent_inode_index;
+    char old_name[MAX_NAME_LEN], new_name[MAX_NAME_LEN];
+    if (resolve_parent(old_path, &old_parent_inode_index, old_name) < 0 ||
+        resolve_parent(new_path, &new_parent_inode_index, new_name) < 0)
+    {
+        return -1;
+    }
+
+    if (is_dot_name(old_name) || is_dot_name(new_name))
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Cannot rename '.' or '..'.");
+        return -1;
     }
 
-    if (file_inode == NULL)
+    union block old_block, new_block;
+    uint32_t old_slot, new_slot;
+    int found = find_entry_slot(old_parent_inode_index, old_name, &old_block, &old_slot);
+    if (found < 0)
+        return -1;
+    if (!found)
     {
-        printf("Error: File inode is NULL.\n");
+        FS_LOG(FS_LOG_ERROR, "Error: '%s' not found.", old_path);
         return -1;
     }
 
-    off_t offset = append ? file_inode->i_size : 0;
-    size_t remaining_bytes = count;
-    const char *write_buf = (const char *)buf;
+    uint32_t source_inode_index = old_block.directory_entries[old_slot % DIRENTS_PER_BLOCK].inode;
+    struct inode_hot *source_hot = &INODE_HOT[source_inode_index];
 
-    while (remaining_bytes > 0)
+    if (source_hot->is_directory && is_self_or_ancestor(source_inode_index, new_parent_inode_index))
     {
-        size_t block_index = offset / BLOCK_SIZE;
-        size_t block_offset = offset % BLOCK_SIZE;
+        FS_LOG(FS_LOG_ERROR, "Error: Cannot move '%s' into itself.", old_path);
+        return -1;
+    }
 
-        uint32_t data_block_num;
+    found = find_entry_slot(new_parent_inode_index, new_name, &new_block, &new_slot);
+    if (found < 0)
+        return -1;
 
-        if (block_index < INODE_DIRECT_POINTERS)
-        {
+    // An existing entry at the new path is replaced, as long as it has the
+    // same type and, for a directory, is empty.
+    uint32_t target_inode_index = 0;
+    if (found)
+    {
+        target_inode_index = new_block.directory_entries[new_slot % DIRENTS_PER_BLOCK].inode;
+        if (target_inode_index == source_inode_index)
+            return 0;
 
-            if (file_inode->i_direct_pointers[block_index] == 0)
-            {
-                uint32_t data_block_index = allocate_data_block();
-                if (data_block_index == (uint32_t)-1)
-                {
-                    printf("Error: No available data blocks.\n");
-                    return -1;
-                }
-                file_inode->i_direct_pointers[block_index] = data_block_index;
-            }
-            data_block_num = file_inode->i_direct_pointers[block_index];
-        }
-        else
+        // The new parent or one of its ancestors cannot be replaced.
+        if (is_self_or_ancestor(target_inode_index, new_parent_inode_index))
         {
+            FS_LOG(FS_LOG_ERROR, "Error: Cannot replace '%s'.", new_path);
+            return -1;
+        }
 
-            block_index -= INODE_DIRECT_POINTERS;
-            if (file_inode->i_indirect_pointer == 0)
-            {
-                uint32_t indirect_block_index = allocate_data_block();
-                if (indirect_block_index == (uint32_t)-1)
-                {
-                    printf("Error: No available data blocks for indirect pointer.\n");
-                    return -1;
-                }
-                file_inode->i_indirect_pointer = indirect_block_index;
-
-                union block indirect_block = {0};
-                if (disk_write(indirect_block_index, &indirect_block) < 0)
-                {
-                    printf("Error: Failed to write indirect block.\n");
-                    return -1;
-                }
-            }
+        if (INODE_HOT[target_inode_index].is_directory != source_hot->is_directory)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: '%s' is %sa directory.", new_path, source_hot->is_directory ? "not " : "");
+            return -1;
+        }
 
-            union block indirect_block;
-            if (disk_read(file_inode->i_indirect_pointer, &indirect_block) < 0)
-            {
-                printf("Error: Failed to read indirect block.\n");
+        if (source_hot->is_directory)
+        {
+            int empty = dir_is_empty(target_inode_index);
+            if (empty < 0)
                 return -1;
-            }
-
-            if (block_index >= BLOCK_SIZE / sizeof(uint32_t))
+            if (!empty)
             {
-                printf("Error: File size exceeds maximum supported size.\n");
+                FS_LOG(FS_LOG_ERROR, "Error: Directory '%s' is not empty.", new_path);
                 return -1;
             }
+        }
+    }
+    else
+    {
+        int hint_in_old_block = new_parent_inode_index == old_parent_inode_index &&
+                                INODE_INFO[new_parent_inode_index].free_hint / DIRENTS_PER_BLOCK ==
+                                    old_slot / DIRENTS_PER_BLOCK;
+        if (claim_free_slot(new_parent_inode_index, hint_in_old_block ? &old_block : &new_block, hint_in_old_block,
+                            &new_slot) < 0)
+            return -1;
+    }
 
-            if (indirect_block.pointers[block_index] == 0)
-            {
-                uint32_t data_block_index = allocate_data_block();
-                if (data_block_index == (uint32_t)-1)
-                {
-                    printf("Error: No available data blocks.\n");
-                    return -1;
-                }
-                indirect_block.pointers[block_index] = data_block_index;
+    // Within one directory block both changes go out in a single write.
+    // Otherwise the new entry is written first, so a crash in between leaves
+    // a second link for fsck to drop rather than losing the file.
+    int same_block = new_parent_inode_index == old_parent_inode_index &&
+                     new_slot / DIRENTS_PER_BLOCK == old_slot / DIRENTS_PER_BLOCK;
+    union block *target_block = same_block ? &old_block : &new_block;
+    struct directory_entry *new_entry = &target_block->directory_entries[new_slot % DIRENTS_PER_BLOCK];
+    new_entry->inode = source_inode_index;
+    strncpy(new_entry->name, new_name, MAX_NAME_LEN);
+    new_entry->name[MAX_NAME_LEN - 1] = '\0';
+
+    if (!same_block &&
+        write_block_cow(DISK_TAG_DIRECTORY,
+                        &INODE_TABLE[new_parent_inode_index].i_direct_pointers[new_slot / DIRENTS_PER_BLOCK],
+                        &new_block) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to write directory data.");
+        return -1;
+    }
 
-                if (disk_write(file_inode->i_indirect_pointer, &indirect_block) < 0)
-                {
-                    printf("Error: Failed to update indirect block.\n");
-                    return -1;
-                }
-            }
-            data_block_num = indirect_block.pointers[block_index];
-        }
+    memset(&old_block.directory_entries[old_slot % DIRENTS_PER_BLOCK], 0, sizeof(struct directory_entry));
+    if (write_block_cow(DISK_TAG_DIRECTORY,
+                        &INODE_TABLE[old_parent_inode_index].i_direct_pointers[old_slot / DIRENTS_PER_BLOCK],
+                        &old_block) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to write directory data.");
+        return -1;
+    }
 
-        union block data_block;
-        if (disk_read(data_block_num, &data_block) < 0)
-        {
-            printf("Error: Failed to read data block.\n");
-            return -1;
-        }
+    if (!target_inode_index)
+        dir_slot_used(new_parent_inode_index, new_slot);
+    dir_slot_freed(old_parent_inode_index, old_slot);
 
-        size_t writable_bytes = BLOCK_SIZE - block_offset;
-        size_t bytes_to_write = (remaining_bytes < writable_bytes) ? remaining_bytes : writable_bytes;
+    if (source_hot->is_directory && old_parent_inode_index != new_parent_inode_index &&
+        update_dotdot(source_inode_index, new_parent_inode_index) < 0)
+    {
+        return -1;
+    }
 
-        memcpy(data_block.data + block_offset, write_buf, bytes_to_write);
+    int64_t moved_bytes = usage_bytes(source_inode_index);
+    int32_t moved_files = source_hot->is_directory ? source_hot->file_count : 1;
+    propagate_usage(old_parent_inode_index, -moved_bytes, -moved_files);
+    source_hot->parent = new_parent_inode_index;
+    propagate_usage(new_parent_inode_index, moved_bytes, moved_files);
+
+    if (target_inode_index)
+    {
+        struct inode *target_inode = &INODE_TABLE[target_inode_index];
+        int64_t removed_bytes = usage_bytes(target_inode_index);
+        int32_t removed_files = INODE_HOT[target_inode_index].is_directory ? 0 : 1;
 
-        if (disk_write(data_block_num, &data_block) < 0)
+        if (INODE_HOT[target_inode_index].is_directory)
         {
-            printf("Error: Failed to write data block.\n");
-            return -1;
+            if (remove_directory_tree(target_inode_index) < 0)
+                return -1;
         }
+        else
+        {
+            if (release_file_blocks(target_inode) < 0)
+                return -1;
 
-        offset += bytes_to_write;
-        write_buf += bytes_to_write;
-        remaining_bytes -= bytes_to_write;
-    }
+            free_inode(target_inode_index);
+        }
 
-    if ((size_t)offset > file_inode->i_size)
-    {
-        file_inode->i_size = offset;
+        propagate_usage(new_parent_inode_index, -removed_bytes, -removed_files);
     }
 
-    printf("Successfully wrote %zu bytes to '%s'.\n", count, path);
+    FS_LOG(FS_LOG_DEBUG, "event=rename src='%s' dst='%s'", old_path, new_path);
     return 0;
 }
 
-int fs_read(const char *path, void *buf, size_t count, off_t offset)
+int fs_rename(const char *old_path, const char *new_path)
+{
+    uint64_t start = stats_now_ns();
+    trace_depth++;
+    int result = rename_path(old_path, new_path);
+    trace_depth--;
+    stats_record_op(FS_OP_RENAME, start, result);
+    TRACE_OP_PAIR(TRACE_RENAME, old_path, new_path, start, result);
+    return result;
+}
+
+int fs_snapshot_create(const char *name)
 {
     if (!MOUNT_FLAG)
     {
-        printf("Error: Filesystem not mounted.\n");
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
         return -1;
     }
 
-    if (!path || path[0] != '/')
+    if (READONLY_FLAG)
     {
-        printf("Error: Path must be absolute and start with '/'.\n");
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem is mounted read-only.");
         return -1;
     }
 
-    if (!buf || count == 0)
+    if (!name || name[0] == '\0' || strlen(name) >= FS_SNAPSHOT_NAME_LEN)
     {
-        printf("Error: Invalid buffer or count.\n");
+        FS_LOG(FS_LOG_ERROR, "Error: Invalid snapshot name.");
         return -1;
     }
 
-    char path_copy[256];
-    strncpy(path_copy, path, sizeof(path_copy));
-    path_copy[sizeof(path_copy) - 1] = '\0';
+    if (find_snapshot(name) >= 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Snapshot '%s' already exists.", name);
+        return -1;
+    }
 
-    char *token;
-    char *rest = path_copy;
-    uint32_t current_inode_index = ROOT_DIR_INODE;
-    uint32_t file_inode_index = 0;
-    char name[MAX_NAME_LEN];
-    struct inode *file_inode = NULL;
+    struct snapshot_record *record = NULL;
+    for (int i = 0; i < FS_MAX_SNAPSHOTS && !record; i++)
+    {
+        if (SUPERBLOCK.superblock.s_snapshots[i].inode_table_start == 0)
+            record = &SUPERBLOCK.superblock.s_snapshots[i];
+    }
 
-    while ((token = strtok_r(rest, "/", &rest)))
+    if (!record)
     {
-        strncpy(name, token, MAX_NAME_LEN);
-        name[MAX_NAME_LEN - 1] = '\0';
+        FS_LOG(FS_LOG_ERROR, "Error: Too many snapshots.");
+        return -1;
+    }
 
-        struct inode *current_inode = &INODE_TABLE[current_inode_index];
+    uint32_t total_inodes = inode_table_block_count() * (BLOCK_SIZE / sizeof(struct inode));
 
-        if (!current_inode->i_is_directory)
-        {
-            printf("Error: '%s' is not a directory.\n", name);
-            return -1;
-        }
+    // Every block the snapshot will reference must be able to take one more.
+    for (uint32_t i = 0; i < total_inodes; i++)
+    {
+        if (!BITMAP_TEST(INODE_BITMAP.bitmap, i))
+            continue;
 
-        int found = 0;
+        struct inode *inode = &INODE_TABLE[i];
         for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
         {
-            if (current_inode->i_direct_pointers[dp] == 0)
-                continue;
-
-            union block data_block;
-            if (disk_read(current_inode->i_direct_pointers[dp], &data_block) < 0)
+            if (holds_block(inode->i_direct_pointers[dp]) && REFCOUNTS[inode->i_direct_pointers[dp]] == REFCOUNT_MAX)
             {
-                printf("Error: Failed to read directory data.\n");
+                FS_LOG(FS_LOG_ERROR, "Error: Block reference count overflow.");
                 return -1;
             }
+        }
+        if (inode->i_indirect_pointer != 0 && REFCOUNTS[inode->i_indirect_pointer] == REFCOUNT_MAX)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Block reference count overflow.");
+            return -1;
+        }
+    }
 
-            struct directory_entry *entries = data_block.directory_entries;
-            for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
-            {
-                entries[i].name[MAX_NAME_LEN - 1] = '\0';
-                if (entries[i].inode != 0 && strcmp(entries[i].name, name) == 0)
-                {
-                    file_inode_index = entries[i].inode;
-                    file_inode = &INODE_TABLE[file_inode_index];
-                    found = 1;
-                    break;
-                }
-            }
+    if (ensure_refcount_table() < 0)
+    {
+        return -1;
+    }
 
-            if (found)
-                break;
-        }
+    // The frozen inode table is followed by the frozen inode bitmap.
+    uint32_t inode_table_blocks = inode_table_block_count();
+    uint32_t snapshot_start = allocate_metadata_run(inode_table_blocks + 1);
+    if (snapshot_start == 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: No space for snapshot '%s'.", name);
+        return -1;
+    }
 
-        if (!found)
+    if (store_inode_table(snapshot_start) < 0 ||
+        write_block(DISK_TAG_BITMAP, snapshot_start + inode_table_blocks, &INODE_BITMAP) < 0)
+    {
+        for (uint32_t i = 0; i <= inode_table_blocks; i++)
         {
-            printf("Error: '%s' not found.\n", path);
-            return -1;
+            release_data_block(snapshot_start + i);
         }
+        return -1;
+    }
+
+    // Only the pointers in the inodes are duplicated; indirect blocks are
+    // shared whole, so the blocks they list keep their counts.
+    for (uint32_t i = 0; i < total_inodes; i++)
+    {
+        if (!BITMAP_TEST(INODE_BITMAP.bitmap, i))
+            continue;
 
-        current_inode_index = file_inode_index;
+        struct inode *inode = &INODE_TABLE[i];
+        for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+        {
+            if (holds_block(inode->i_direct_pointers[dp]))
+                REFCOUNTS[inode->i_direct_pointers[dp]]++;
+        }
+        if (inode->i_indirect_pointer != 0)
+            REFCOUNTS[inode->i_indirect_pointer]++;
     }
 
-    if (file_inode == NULL)
+    memset(record, 0, sizeof(*record));
+    strncpy(record->name, name, FS_SNAPSHOT_NAME_LEN - 1);
+    record->inode_table_start = snapshot_start;
+    record->inode_bitmap = snapshot_start + inode_table_blocks;
+
+    if (write_block(DISK_TAG_SUPERBLOCK, 0, &SUPERBLOCK) < 0 || store_refcounts() < 0)
     {
-        printf("Error: File inode is NULL.\n");
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to write filesystem metadata.");
         return -1;
     }
 
-    if (file_inode->i_is_directory)
+    FS_LOG(FS_LOG_DEBUG, "event=snapshot_create name='%s' start=%u", name, snapshot_start);
+    return 0;
+}
+
+int fs_snapshot_delete(const char *name)
+{
+    if (!MOUNT_FLAG)
     {
-        printf("Error: '%s' is a directory.\n", path);
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
         return -1;
     }
 
-    if ((size_t)offset >= file_inode->i_size)
+    if (READONLY_FLAG)
     {
-        printf("Error: Offset is beyond the file size.\n");
-        return 0;
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem is mounted read-only.");
+        return -1;
     }
 
-    if (offset + count > file_inode->i_size)
+    int snapshot = name ? find_snapshot(name) : -1;
+    if (snapshot < 0)
     {
-        count = file_inode->i_size - offset;
+        FS_LOG(FS_LOG_ERROR, "Error: Snapshot '%s' not found.", name ? name : "");
+        return -1;
     }
 
-    size_t remaining_bytes = count;
-    char *read_buf = (char *)buf;
-    size_t total_read = 0;
+    struct snapshot_record *record = &SUPERBLOCK.superblock.s_snapshots[snapshot];
+    uint32_t inode_table_blocks = inode_table_block_count();
+    uint32_t inodes_per_block = BLOCK_SIZE / sizeof(struct inode);
 
-    while (remaining_bytes > 0)
+    union block frozen_bitmap;
+    if (read_block(DISK_TAG_BITMAP, record->inode_bitmap, &frozen_bitmap) < 0)
     {
-        size_t block_index = offset / BLOCK_SIZE;
-        size_t block_offset = offset % BLOCK_SIZE;
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to read snapshot inode bitmap.");
+        return -1;
+    }
 
-        uint32_t data_block_num;
+    // Drop the references held by every inode in the frozen table; blocks the
+    // live filesystem no longer uses are freed on the way.
+    for (uint32_t i = 0; i < inode_table_blocks; i++)
+    {
+        union block inode_block;
+        if (read_block(DISK_TAG_INODE, record->inode_table_start + i, &inode_block) < 0)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Failed to read snapshot inode table.");
+            return -1;
+        }
 
-        if (block_index < INODE_DIRECT_POINTERS)
+        for (uint32_t j = 0; j < inodes_per_block; j++)
         {
-            if (file_inode->i_direct_pointers[block_index] == 0)
+            if (BITMAP_TEST(frozen_bitmap.bitmap, i * inodes_per_block + j) &&
+                release_file_blocks(&inode_block.inodes[j]) < 0)
             {
-                printf("Error: Invalid block access.\n");
                 return -1;
             }
-            data_block_num = file_inode->i_direct_pointers[block_index];
         }
-        else
-        {
-
-            block_index -= INODE_DIRECT_POINTERS;
+    }
 
-            if (file_inode->i_indirect_pointer == 0)
-            {
-                printf("Error: Invalid block access.\n");
-                return -1;
-            }
+    for (uint32_t i = 0; i < inode_table_blocks; i++)
+    {
+        release_data_block(record->inode_table_start + i);
+    }
+    release_data_block(record->inode_bitmap);
 
-            union block indirect_block;
-            if (disk_read(file_inode->i_indirect_pointer, &indirect_block) < 0)
-            {
-                printf("Error: Failed to read indirect block.\n");
-                return -1;
-            }
+    memset(record, 0, sizeof(*record));
+    if (write_block(DISK_TAG_SUPERBLOCK, 0, &SUPERBLOCK) < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to write superblock.");
+        return -1;
+    }
 
-            if (block_index >= BLOCK_SIZE / sizeof(uint32_t))
-            {
-                printf("Error: Block index out of bounds.\n");
-                return -1;
-            }
+    FS_LOG(FS_LOG_DEBUG, "event=snapshot_delete name='%s'", name);
+    return 0;
+}
 
-            if (indirect_block.pointers[block_index] == 0)
-            {
-                printf("Error: Invalid block access.\n");
-                return -1;
-            }
+static uint32_t count_clear_bits(const uint32_t *bitmap, uint32_t start, uint32_t end)
+{
+    uint32_t clear = 0;
+    uint32_t i = start;
 
-            data_block_num = indirect_block.pointers[block_index];
-        }
+    for (; i < end && i % 32 != 0; i++)
+    {
+        if (!BITMAP_TEST(bitmap, i))
+            clear++;
+    }
+    for (; i + 32 <= end; i += 32)
+    {
+        clear += 32 - __builtin_popcount(bitmap[i / 32]);
+    }
+    for (; i < end; i++)
+    {
+        if (!BITMAP_TEST(bitmap, i))
+            clear++;
+    }
 
-        union block data_block;
-        if (disk_read(data_block_num, &data_block) < 0)
-        {
-            printf("Error: Failed to read data block.\n");
-            return -1;
-        }
+    return clear;
+}
 
-        size_t readable_bytes = BLOCK_SIZE - block_offset;
-        size_t bytes_to_read = (remaining_bytes < readable_bytes) ? remaining_bytes : readable_bytes;
+int fs_get_stats(struct fs_stats *stats)
+{
+    if (!stats)
+    {
+        return -1;
+    }
 
-        memcpy(read_buf, data_block.data + block_offset, bytes_to_read);
+    memset(stats, 0, sizeof(*stats));
 
-        read_buf += bytes_to_read;
-        offset += bytes_to_read;
-        remaining_bytes -= bytes_to_read;
-        total_read += bytes_to_read;
+    if (MOUNT_FLAG)
+    {
+        stats->total_blocks = SUPERBLOCK.superblock.s_blocks_count;
+        stats->free_blocks = count_clear_bits(BLOCK_BITMAP.bitmap, SUPERBLOCK.superblock.s_data_blocks_start,
+                                              SUPERBLOCK.superblock.s_blocks_count);
+        stats->pending_free_blocks = pending_free_count;
+        stats->total_inodes = SUPERBLOCK.superblock.s_inodes_count;
+        stats->free_inodes = count_clear_bits(INODE_BITMAP.bitmap, 0, SUPERBLOCK.superblock.s_inodes_count);
     }
 
-    printf("Successfully read %zu bytes from '%s'.\n", total_read, path);
-    return total_read;
+    stats_collect(stats);
+    disk_get_stats(&stats->disk);
+    slab_collect(stats->slabs);
+    return 0;
+}
+
+void fs_reset_stats()
+{
+    stats_reset();
+    disk_reset_stats();
+}
+
+int fs_export_stats(char *buf, size_t len)
+{
+    struct fs_stats stats;
+    fs_get_stats(&stats);
+    return stats_format_prometheus(&stats, buf, len);
 }
 
 void fs_stat()
 {
     if (!MOUNT_FLAG)
     {
-        printf("Error: Filesystem not mounted.\n");
+        FS_LOG(FS_LOG_ERROR, "Error: Filesystem not mounted.");
         return;
     }
 
+    struct fs_stats stats;
+    fs_get_stats(&stats);
+
     printf("Filesystem Statistics:\n");
-    printf("Total Blocks: %u\n", SUPERBLOCK.superblock.s_blocks_count);
-    printf("Total Inodes: %u\n", SUPERBLOCK.superblock.s_inodes_count);
+    printf("Total Blocks: %u\n", stats.total_blocks);
+    printf("Free Blocks: %u\n", stats.free_blocks + stats.pending_free_blocks);
+    printf("Total Inodes: %u\n", stats.total_inodes);
+    printf("Free Inodes: %u\n", stats.free_inodes);
 }
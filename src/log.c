@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "log.h"
+
+enum fs_log_level fs_log_threshold = FS_LOG_WARN;
+
+static void default_handler(enum fs_log_level level, const char *message, void *context);
+
+static fs_log_handler log_handler = default_handler;
+static void *log_context = NULL;
+
+static void default_handler(enum fs_log_level level, const char *message, void *context)
+{
+    (void)level;
+    (void)context;
+    printf("%s\n", message);
+}
+
+void fs_set_log_handler(fs_log_handler handler, void *context)
+{
+    log_handler = handler ? handler : default_handler;
+    log_context = handler ? context : NULL;
+}
+
+void fs_set_log_level(enum fs_log_level level)
+{
+    fs_log_threshold = level;
+}
+
+void fs_log_write(enum fs_log_level level, const char *format, ...)
+{
+    char message[512];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    log_handler(level, message, log_context);
+}
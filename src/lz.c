@@ -0,0 +1,186 @@
+#include <string.h>
+
+#include "lz.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+#define LZ_LAST_LITERALS 5 // the input always ends in a literal run this long
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t hash_sequence(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * Writes the part of a length that does not fit in its token nibble.
+ */
+static uint8_t *put_length(uint8_t *op, size_t length)
+{
+    for (length -= 15; length >= 255; length -= 255)
+        *op++ = 255;
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+/**
+ * Emits one sequence: `literal_len` literals followed by a match, or only
+ * the literals when match_len is 0 (the final sequence).
+ *
+ * @return The new output position, or NULL if the sequence does not fit.
+ */
+static uint8_t *emit_sequence(uint8_t *op, const uint8_t *end, const uint8_t *literals, size_t literal_len,
+                              size_t offset, size_t match_len)
+{
+    // Token, worst-case length bytes on both sides, literals and offset.
+    if ((size_t)(end - op) < 1 + literal_len / 255 + 1 + literal_len + 2 + match_len / 255 + 1)
+        return NULL;
+
+    uint8_t *token = op++;
+    size_t match_code = match_len ? match_len - LZ_MIN_MATCH : 0;
+
+    *token = (uint8_t)((literal_len < 15 ? literal_len : 15) << 4);
+    if (literal_len >= 15)
+        op = put_length(op, literal_len);
+
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+
+    if (match_len == 0)
+        return op;
+
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+
+    *token |= (uint8_t)(match_code < 15 ? match_code : 15);
+    if (match_code >= 15)
+        op = put_length(op, match_code);
+
+    return op;
+}
+
+size_t lz_compress(const void *src, size_t len, void *dst, size_t capacity)
+{
+    const uint8_t *in = src;
+    uint8_t *op = dst;
+    const uint8_t *out_end = op + capacity;
+    uint32_t table[1 << LZ_HASH_BITS];
+    size_t anchor = 0;
+    size_t ip = 0;
+
+    memset(table, 0, sizeof(table));
+
+    // Positions are stored plus one so that zero marks an empty slot.
+    while (len >= LZ_LAST_LITERALS + LZ_MIN_MATCH && ip + LZ_MIN_MATCH <= len - LZ_LAST_LITERALS)
+    {
+        uint32_t sequence = read32(in + ip);
+        uint32_t h = hash_sequence(sequence);
+        size_t candidate = table[h];
+        table[h] = ip + 1;
+
+        if (candidate == 0 || ip - (candidate - 1) > LZ_MAX_OFFSET || read32(in + candidate - 1) != sequence)
+        {
+            ip++;
+            continue;
+        }
+
+        size_t ref = candidate - 1;
+        size_t match_len = LZ_MIN_MATCH;
+        while (ip + match_len < len - LZ_LAST_LITERALS && in[ref + match_len] == in[ip + match_len])
+            match_len++;
+
+        op = emit_sequence(op, out_end, in + anchor, ip - anchor, ip - ref, match_len);
+        if (!op)
+            return 0;
+
+        ip += match_len;
+        anchor = ip;
+    }
+
+    op = emit_sequence(op, out_end, in + anchor, len - anchor, 0, 0);
+    if (!op)
+        return 0;
+
+    return op - (uint8_t *)dst;
+}
+
+/**
+ * Reads the part of a length that did not fit in its token nibble.
+ */
+static int get_length(const uint8_t **ip, const uint8_t *end, size_t *length)
+{
+    uint8_t byte;
+    do
+    {
+        if (*ip >= end)
+            return -1;
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+
+    return 0;
+}
+
+long lz_decompress(const void *src, size_t len, void *dst, size_t capacity)
+{
+    const uint8_t *ip = src;
+    const uint8_t *in_end = ip + len;
+    uint8_t *op = dst;
+    uint8_t *out_end = op + capacity;
+
+    while (ip < in_end)
+    {
+        uint8_t token = *ip++;
+
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && get_length(&ip, in_end, &literal_len) < 0)
+            return -1;
+
+        if ((size_t)(in_end - ip) < literal_len || (size_t)(out_end - op) < literal_len)
+            return -1;
+
+        memcpy(op, ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+
+        // The final sequence carries literals only.
+        if (ip == in_end)
+            break;
+
+        if (in_end - ip < 2)
+            return -1;
+
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        size_t match_len = token & 15;
+        if (match_len == 15 && get_length(&ip, in_end, &match_len) < 0)
+            return -1;
+        match_len += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > (size_t)(op - (uint8_t *)dst) || (size_t)(out_end - op) < match_len)
+            return -1;
+
+        // A match that overlaps the bytes it produces is copied byte by byte.
+        const uint8_t *match = op - offset;
+        if (offset >= match_len)
+        {
+            memcpy(op, match, match_len);
+        }
+        else
+        {
+            for (size_t i = 0; i < match_len; i++)
+                op[i] = match[i];
+        }
+        op += match_len;
+    }
+
+    return op - (uint8_t *)dst;
+}
@@ -0,0 +1,224 @@
+#include <stdlib.h>
+
+#include "slab.h"
+#include "log.h"
+
+#define SLAB_CHUNK_BYTES (128 * 1024)
+#define SLAB_BATCH 16               // objects moved between a thread and the shared list at once
+#define SLAB_THREAD_MAX (2 * SLAB_BATCH)
+
+struct free_object
+{
+    struct free_object *next;
+};
+
+struct slab
+{
+    const char *name;
+    size_t object_size;
+    size_t align;
+    char lock;
+    struct free_object *shared;     // protected by lock
+    uint32_t chunks;                // protected by lock
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t refills;
+};
+
+struct thread_list
+{
+    struct free_object *head;
+    uint32_t count;
+};
+
+static struct slab SLABS[FS_SLAB_COUNT] = {
+    [FS_SLAB_BLOCK] = {.name = "block"},
+    [FS_SLAB_DIR_HANDLE] = {.name = "dir_handle"},
+};
+
+static __thread struct thread_list THREAD_LISTS[FS_SLAB_COUNT];
+
+static void lock_slab(struct slab *slab)
+{
+    while (__atomic_test_and_set(&slab->lock, __ATOMIC_ACQUIRE))
+    {
+        while (__atomic_load_n(&slab->lock, __ATOMIC_RELAXED))
+            ;
+    }
+}
+
+static void unlock_slab(struct slab *slab)
+{
+    __atomic_clear(&slab->lock, __ATOMIC_RELEASE);
+}
+
+int slab_init(enum fs_slab kind, size_t object_size, size_t align)
+{
+    struct slab *slab = &SLABS[kind];
+
+    if (align < sizeof(struct free_object))
+        align = sizeof(struct free_object);
+    object_size = (object_size + align - 1) & ~(align - 1);
+
+    if (slab->object_size)
+    {
+        if (slab->object_size == object_size && slab->align == align)
+            return 0;
+
+        FS_LOG(FS_LOG_ERROR, "Error: Slab '%s' already holds %zu-byte objects.", slab->name, slab->object_size);
+        return -1;
+    }
+
+    slab->object_size = object_size;
+    slab->align = align;
+    return 0;
+}
+
+static size_t chunk_objects(const struct slab *slab)
+{
+    size_t count = SLAB_CHUNK_BYTES / slab->object_size;
+    return count < SLAB_BATCH ? SLAB_BATCH : count;
+}
+
+/**
+ * Carves a new chunk into objects on the shared list. Called with the lock held.
+ */
+static int grow_slab(struct slab *slab)
+{
+    size_t count = chunk_objects(slab);
+
+    uint8_t *chunk = aligned_alloc(slab->align, count * slab->object_size);
+    if (!chunk)
+        return -1;
+
+    for (size_t i = count; i-- > 0;)
+    {
+        struct free_object *object = (struct free_object *)(chunk + i * slab->object_size);
+        object->next = slab->shared;
+        slab->shared = object;
+    }
+    slab->chunks++;
+    return 0;
+}
+
+/**
+ * Moves up to SLAB_BATCH objects from the shared list to the calling thread,
+ * growing the slab when the shared list is empty.
+ */
+static int refill_thread_list(struct slab *slab, struct thread_list *list)
+{
+    lock_slab(slab);
+
+    if (!slab->shared && grow_slab(slab) < 0)
+    {
+        unlock_slab(slab);
+        FS_LOG(FS_LOG_ERROR, "Error: Failed to grow slab '%s'.", slab->name);
+        return -1;
+    }
+
+    for (int i = 0; i < SLAB_BATCH && slab->shared; i++)
+    {
+        struct free_object *object = slab->shared;
+        slab->shared = object->next;
+        object->next = list->head;
+        list->head = object;
+        list->count++;
+    }
+
+    unlock_slab(slab);
+    __atomic_fetch_add(&slab->refills, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * Moves `count` objects from the calling thread back to the shared list.
+ */
+static void drain_thread_list(struct slab *slab, struct thread_list *list, uint32_t count)
+{
+    if (count == 0)
+        return;
+
+    // Detach the first `count` objects, then splice them in with one lock.
+    struct free_object *first = list->head;
+    struct free_object *last = first;
+    for (uint32_t i = 1; i < count; i++)
+        last = last->next;
+
+    list->head = last->next;
+    list->count -= count;
+
+    lock_slab(slab);
+    last->next = slab->shared;
+    slab->shared = first;
+    unlock_slab(slab);
+}
+
+void *slab_alloc(enum fs_slab kind)
+{
+    struct slab *slab = &SLABS[kind];
+    struct thread_list *list = &THREAD_LISTS[kind];
+
+    if (!list->head)
+    {
+        if (!slab->object_size)
+        {
+            FS_LOG(FS_LOG_ERROR, "Error: Slab '%s' is not set up.", slab->name);
+            return NULL;
+        }
+        if (refill_thread_list(slab, list) < 0)
+            return NULL;
+    }
+
+    struct free_object *object = list->head;
+    list->head = object->next;
+    list->count--;
+    __atomic_fetch_add(&slab->allocs, 1, __ATOMIC_RELAXED);
+    return object;
+}
+
+void slab_free(enum fs_slab kind, void *object)
+{
+    if (!object)
+        return;
+
+    struct slab *slab = &SLABS[kind];
+    struct thread_list *list = &THREAD_LISTS[kind];
+    struct free_object *node = object;
+
+    node->next = list->head;
+    list->head = node;
+    list->count++;
+    __atomic_fetch_add(&slab->frees, 1, __ATOMIC_RELAXED);
+
+    // Keep a batch around for the next allocations and return the rest.
+    if (list->count > SLAB_THREAD_MAX)
+        drain_thread_list(slab, list, list->count - SLAB_BATCH);
+}
+
+void slab_thread_flush()
+{
+    for (int kind = 0; kind < FS_SLAB_COUNT; kind++)
+        drain_thread_list(&SLABS[kind], &THREAD_LISTS[kind], THREAD_LISTS[kind].count);
+}
+
+void slab_collect(struct fs_slab_stats *stats)
+{
+    for (int kind = 0; kind < FS_SLAB_COUNT; kind++)
+    {
+        struct slab *slab = &SLABS[kind];
+        uint64_t allocs = __atomic_load_n(&slab->allocs, __ATOMIC_RELAXED);
+        uint64_t frees = __atomic_load_n(&slab->frees, __ATOMIC_RELAXED);
+
+        stats[kind].object_size = (uint32_t)slab->object_size;
+        stats[kind].reserved_bytes = slab->object_size ? (uint64_t)__atomic_load_n(&slab->chunks, __ATOMIC_RELAXED) *
+                                                             chunk_objects(slab) * slab->object_size : 0;
+        stats[kind].in_use = allocs > frees ? allocs - frees : 0;
+        stats[kind].allocs = allocs;
+        stats[kind].refills = __atomic_load_n(&slab->refills, __ATOMIC_RELAXED);
+    }
+}
+
+const char *slab_name(enum fs_slab kind)
+{
+    return kind < FS_SLAB_COUNT ? SLABS[kind].name : "unknown";
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+static struct fs_op_stats OP_STATS[FS_OP_COUNT];
+static struct fs_cache_stats CACHE_STATS[FS_CACHE_COUNT];
+
+static const char *OP_NAMES[FS_OP_COUNT] = {
+    "create",
+    "read",
+    "write",
+    "remove",
+    "lookup",
+    "rename",
+};
+
+static const char *CACHE_NAMES[FS_CACHE_COUNT] = {
+    "bmap",
+    "dedup",
+    "cluster",
+};
+
+uint64_t stats_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void stats_record_op(enum fs_op op, uint64_t start_ns, long result)
+{
+    uint64_t elapsed = stats_now_ns() - start_ns;
+    struct fs_op_stats *op_stats = &OP_STATS[op];
+
+    // Bucket i holds latencies in [2^(i-1), 2^i).
+    int bucket = elapsed == 0 ? 0 : 64 - __builtin_clzll(elapsed);
+    if (bucket >= FS_LATENCY_BUCKETS)
+        bucket = FS_LATENCY_BUCKETS - 1;
+
+    op_stats->count++;
+    op_stats->total_ns += elapsed;
+    op_stats->histogram[bucket]++;
+    if (result < 0)
+        op_stats->errors++;
+}
+
+void stats_record_cache(enum fs_cache cache, int hit)
+{
+    if (hit)
+        CACHE_STATS[cache].hits++;
+    else
+        CACHE_STATS[cache].misses++;
+}
+
+void stats_collect(struct fs_stats *stats)
+{
+    memcpy(stats->ops, OP_STATS, sizeof(OP_STATS));
+    memcpy(stats->caches, CACHE_STATS, sizeof(CACHE_STATS));
+}
+
+void stats_reset()
+{
+    memset(OP_STATS, 0, sizeof(OP_STATS));
+    memset(CACHE_STATS, 0, sizeof(CACHE_STATS));
+}
+
+const char *stats_op_name(enum fs_op op)
+{
+    return op < FS_OP_COUNT ? OP_NAMES[op] : "unknown";
+}
+
+int stats_format_prometheus(const struct fs_stats *stats, char *buf, size_t len)
+{
+    size_t used = 0;
+    int n;
+
+// Appends to buf while tracking the full length, like snprintf does.
+#define EMIT(...)                                                           \
+    do                                                                      \
+    {                                                                       \
+        n = snprintf(buf + (used < len ? used : len), used < len ? len - used : 0, __VA_ARGS__); \
+        if (n < 0)                                                          \
+            return -1;                                                      \
+        used += n;                                                          \
+    } while (0)
+
+    EMIT("# TYPE fs_blocks_total gauge\nfs_blocks_total %u\n", stats->total_blocks);
+    EMIT("# TYPE fs_blocks_free gauge\nfs_blocks_free %u\n", stats->free_blocks);
+    EMIT("# TYPE fs_blocks_pending_free gauge\nfs_blocks_pending_free %u\n", stats->pending_free_blocks);
+    EMIT("# TYPE fs_inodes_total gauge\nfs_inodes_total %u\n", stats->total_inodes);
+    EMIT("# TYPE fs_inodes_free gauge\nfs_inodes_free %u\n", stats->free_inodes);
+
+    EMIT("# TYPE fs_op_errors_total counter\n");
+    for (int op = 0; op < FS_OP_COUNT; op++)
+        EMIT("fs_op_errors_total{op=\"%s\"} %llu\n", OP_NAMES[op], (unsigned long long)stats->ops[op].errors);
+
+    EMIT("# TYPE fs_op_latency_seconds histogram\n");
+    for (int op = 0; op < FS_OP_COUNT; op++)
+    {
+        const struct fs_op_stats *op_stats = &stats->ops[op];
+        uint64_t cumulative = 0;
+
+        for (int i = 0; i < FS_LATENCY_BUCKETS - 1; i++)
+        {
+            cumulative += op_stats->histogram[i];
+            EMIT("fs_op_latency_seconds_bucket{op=\"%s\",le=\"%.9g\"} %llu\n",
+                 OP_NAMES[op], (double)(1ull << i) / 1e9, (unsigned long long)cumulative);
+        }
+        EMIT("fs_op_latency_seconds_bucket{op=\"%s\",le=\"+Inf\"} %llu\n", OP_NAMES[op], (unsigned long long)op_stats->count);
+        EMIT("fs_op_latency_seconds_sum{op=\"%s\"} %.9f\n", OP_NAMES[op], (double)op_stats->total_ns / 1e9);
+        EMIT("fs_op_latency_seconds_count{op=\"%s\"} %llu\n", OP_NAMES[op], (unsigned long long)op_stats->count);
+    }
+
+    EMIT("# TYPE fs_cache_hits_total counter\n");
+    for (int cache = 0; cache < FS_CACHE_COUNT; cache++)
+        EMIT("fs_cache_hits_total{cache=\"%s\"} %llu\n", CACHE_NAMES[cache], (unsigned long long)stats->caches[cache].hits);
+    EMIT("# TYPE fs_cache_misses_total counter\n");
+    for (int cache = 0; cache < FS_CACHE_COUNT; cache++)
+        EMIT("fs_cache_misses_total{cache=\"%s\"} %llu\n", CACHE_NAMES[cache], (unsigned long long)stats->caches[cache].misses);
+
+    EMIT("# TYPE fs_disk_reads_total counter\nfs_disk_reads_total %llu\n", (unsigned long long)stats->disk.reads);
+    EMIT("# TYPE fs_disk_writes_total counter\nfs_disk_writes_total %llu\n", (unsigned long long)stats->disk.writes);
+    EMIT("# TYPE fs_disk_read_bytes_total counter\nfs_disk_read_bytes_total %llu\n", (unsigned long long)stats->disk.bytes_read);
+    EMIT("# TYPE fs_disk_written_bytes_total counter\nfs_disk_written_bytes_total %llu\n", (unsigned long long)stats->disk.bytes_written);
+    EMIT("# TYPE fs_disk_discarded_blocks_total counter\nfs_disk_discarded_blocks_total %llu\n", (unsigned long long)stats->disk.discarded_blocks);
+    EMIT("# TYPE fs_disk_checksum_errors_total counter\nfs_disk_checksum_errors_total %llu\n", (unsigned long long)stats->disk.checksum_errors);
+    EMIT("# TYPE fs_disk_checksum_seconds_total counter\nfs_disk_checksum_seconds_total %.9f\n", (double)stats->disk.checksum_ns / 1e9);
+    EMIT("# TYPE fs_disk_direct_bounces_total counter\nfs_disk_direct_bounces_total %llu\n", (unsigned long long)stats->disk.direct_bounces);
+
+    EMIT("# TYPE fs_slab_objects_in_use gauge\n");
+    for (int slab = 0; slab < FS_SLAB_COUNT; slab++)
+        EMIT("fs_slab_objects_in_use{slab=\"%s\"} %llu\n", slab_name(slab), (unsigned long long)stats->slabs[slab].in_use);
+    EMIT("# TYPE fs_slab_reserved_bytes gauge\n");
+    for (int slab = 0; slab < FS_SLAB_COUNT; slab++)
+        EMIT("fs_slab_reserved_bytes{slab=\"%s\"} %llu\n", slab_name(slab), (unsigned long long)stats->slabs[slab].reserved_bytes);
+    EMIT("# TYPE fs_slab_allocs_total counter\n");
+    for (int slab = 0; slab < FS_SLAB_COUNT; slab++)
+        EMIT("fs_slab_allocs_total{slab=\"%s\"} %llu\n", slab_name(slab), (unsigned long long)stats->slabs[slab].allocs);
+    EMIT("# TYPE fs_slab_refills_total counter\n");
+    for (int slab = 0; slab < FS_SLAB_COUNT; slab++)
+        EMIT("fs_slab_refills_total{slab=\"%s\"} %llu\n", slab_name(slab), (unsigned long long)stats->slabs[slab].refills);
+
+#undef EMIT
+
+    return (int)used;
+}
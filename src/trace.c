@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "stats.h"
+#include "log.h"
+
+#define TRACE_BUFFER_SIZE 65536
+#define TRACE_PATH_TAG 0xFF
+#define TRACE_FAILED_FLAG 0x80
+
+int trace_enabled = 0;
+int trace_depth = 0;
+
+struct path_slot
+{
+    char *path;
+    uint64_t hash;
+    uint32_t id;
+};
+
+static FILE *trace_file = NULL;
+static uint8_t trace_buffer[TRACE_BUFFER_SIZE];
+static size_t trace_used = 0;
+static uint64_t last_ns = 0;
+
+static struct path_slot *path_slots = NULL;
+static uint32_t path_capacity = 0;
+static uint32_t path_count = 0;
+
+static const char *TRACE_OP_NAMES[TRACE_OP_COUNT] = {
+    "create",
+    "mkdir",
+    "read",
+    "write",
+    "append",
+    "pwrite",
+    "remove",
+    "truncate",
+    "rename",
+    "clone",
+    "fallocate",
+};
+
+struct trace_reader
+{
+    FILE *file;
+    char **paths;
+    uint32_t path_count;
+    uint32_t path_capacity;
+};
+
+/**
+ * Returns 1 for operations whose records carry a second path id after the first.
+ */
+static int op_has_target(enum trace_op op)
+{
+    return op == TRACE_RENAME || op == TRACE_CLONE;
+}
+
+static uint64_t hash_path(const char *path)
+{
+    // FNV-1a.
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (; *path; path++)
+    {
+        hash ^= (uint8_t)*path;
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+static void free_path_table()
+{
+    for (uint32_t i = 0; i < path_capacity; i++)
+    {
+        free(path_slots[i].path);
+    }
+    free(path_slots);
+    path_slots = NULL;
+    path_capacity = 0;
+    path_count = 0;
+}
+
+static int grow_path_table()
+{
+    uint32_t new_capacity = path_capacity ? path_capacity * 2 : 1024;
+    struct path_slot *new_slots = calloc(new_capacity, sizeof(struct path_slot));
+    if (!new_slots)
+        return -1;
+
+    for (uint32_t i = 0; i < path_capacity; i++)
+    {
+        if (!path_slots[i].path)
+            continue;
+
+        uint32_t j = path_slots[i].hash & (new_capacity - 1);
+        while (new_slots[j].path)
+            j = (j + 1) & (new_capacity - 1);
+        new_slots[j] = path_slots[i];
+    }
+
+    free(path_slots);
+    path_slots = new_slots;
+    path_capacity = new_capacity;
+    return 0;
+}
+
+/**
+ * Writes out the buffered records. A short write leaves a record cut in
+ * half, so anything less than the whole buffer is an error.
+ */
+static int flush_buffer()
+{
+    if (trace_used == 0)
+        return 0;
+
+    size_t written = fwrite(trace_buffer, 1, trace_used, trace_file);
+    int result = written == trace_used ? 0 : -1;
+    trace_used = 0;
+    return result;
+}
+
+static void put_varint(uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        trace_buffer[trace_used++] = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    trace_buffer[trace_used++] = (uint8_t)value;
+}
+
+/**
+ * Returns the id of `path`, emitting a path record the first time it is seen.
+ */
+static int intern_path(const char *path, uint32_t *id)
+{
+    uint64_t hash = hash_path(path);
+
+    if ((path_count + 1) * 10 > path_capacity * 7 && grow_path_table() < 0)
+        return -1;
+
+    uint32_t i = hash & (path_capacity - 1);
+    while (path_slots[i].path)
+    {
+        if (path_slots[i].hash == hash && strcmp(path_slots[i].path, path) == 0)
+        {
+            *id = path_slots[i].id;
+            return 0;
+        }
+        i = (i + 1) & (path_capacity - 1);
+    }
+
+    size_t len = strlen(path);
+    if (len + 21 > TRACE_BUFFER_SIZE)
+        return -1;
+
+    char *copy = malloc(len + 1);
+    if (!copy)
+        return -1;
+    memcpy(copy, path, len + 1);
+
+    path_slots[i].path = copy;
+    path_slots[i].hash = hash;
+    path_slots[i].id = path_count++;
+    *id = path_slots[i].id;
+
+    if (trace_used + 21 + len > TRACE_BUFFER_SIZE && flush_buffer() < 0)
+        return -1;
+
+    trace_buffer[trace_used++] = TRACE_PATH_TAG;
+    put_varint(*id);
+    put_varint(len);
+    memcpy(trace_buffer + trace_used, path, len);
+    trace_used += len;
+    return 0;
+}
+
+int fs_trace_start(const char *filename)
+{
+    if (trace_file)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Trace already active.");
+        return -1;
+    }
+
+    trace_file = fopen(filename, "wb");
+    if (!trace_file)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Could not open trace file '%s'.", filename);
+        return -1;
+    }
+
+    uint32_t header[2] = {TRACE_MAGIC, TRACE_VERSION};
+    memcpy(trace_buffer, header, sizeof(header));
+    trace_used = sizeof(header);
+    last_ns = stats_now_ns();
+    trace_enabled = 1;
+    return 0;
+}
+
+int fs_trace_stop()
+{
+    if (!trace_file)
+        return -1;
+
+    trace_enabled = 0;
+    int result = flush_buffer();
+    if (fclose(trace_file) != 0)
+        result = -1;
+
+    trace_file = NULL;
+    free_path_table();
+    return result;
+}
+
+static void append_record(enum trace_op op, const char *path, const char *target, uint64_t offset, uint64_t size,
+                          uint64_t start_ns, long result)
+{
+    uint32_t path_id, target_id = 0;
+    uint64_t now = stats_now_ns();
+
+    if (!path)
+        path = "";
+    if (!target)
+        target = "";
+
+    // Both paths are interned first: their records must precede the operation.
+    if (intern_path(path, &path_id) < 0 || (op_has_target(op) && intern_path(target, &target_id) < 0))
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Could not record trace path, tracing stopped.");
+        fs_trace_stop();
+        return;
+    }
+
+    // Tag plus six varints of at most 10 bytes each.
+    if (trace_used + 61 > TRACE_BUFFER_SIZE && flush_buffer() < 0)
+    {
+        FS_LOG(FS_LOG_ERROR, "Error: Could not write trace, tracing stopped.");
+        fs_trace_stop();
+        return;
+    }
+
+    trace_buffer[trace_used++] = (uint8_t)op | (result < 0 ? TRACE_FAILED_FLAG : 0);
+    put_varint(path_id);
+    if (op_has_target(op))
+        put_varint(target_id);
+    put_varint(offset);
+    put_varint(size);
+    put_varint(now - start_ns);
+    put_varint(start_ns > last_ns ? start_ns - last_ns : 0);
+    last_ns = start_ns;
+}
+
+void trace_record(enum trace_op op, const char *path, uint64_t offset, uint64_t size, uint64_t start_ns, long result)
+{
+    append_record(op, path, NULL, offset, size, start_ns, result);
+}
+
+void trace_record_pair(enum trace_op op, const char *path, const char *target, uint64_t start_ns, long result)
+{
+    append_record(op, path, target, 0, 0, start_ns, result);
+}
+
+static int get_varint(FILE *file, uint64_t *value)
+{
+    uint64_t result = 0;
+
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int c = getc(file);
+        if (c == EOF)
+            return -1;
+
+        result |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80))
+        {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+struct trace_reader *trace_reader_open(const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+        return NULL;
+
+    uint32_t header[2];
+    if (fread(header, sizeof(header), 1, file) != 1 || header[0] != TRACE_MAGIC || header[1] < 1 ||
+        header[1] > TRACE_VERSION)
+    {
+        fclose(file);
+        return NULL;
+    }
+
+    struct trace_reader *reader = calloc(1, sizeof(struct trace_reader));
+    if (!reader)
+    {
+        fclose(file);
+        return NULL;
+    }
+
+    reader->file = file;
+    return reader;
+}
+
+static int read_path_record(struct trace_reader *reader)
+{
+    uint64_t id, len;
+    if (get_varint(reader->file, &id) < 0 || get_varint(reader->file, &len) < 0 || id != reader->path_count)
+        return -1;
+
+    if (reader->path_count == reader->path_capacity)
+    {
+        uint32_t new_capacity = reader->path_capacity ? reader->path_capacity * 2 : 1024;
+        char **paths = realloc(reader->paths, new_capacity * sizeof(char *));
+        if (!paths)
+            return -1;
+        reader->paths = paths;
+        reader->path_capacity = new_capacity;
+    }
+
+    char *path = malloc(len + 1);
+    if (!path)
+        return -1;
+    if (fread(path, 1, len, reader->file) != len)
+    {
+        free(path);
+        return -1;
+    }
+    path[len] = '\0';
+
+    reader->paths[reader->path_count++] = path;
+    return 0;
+}
+
+int trace_reader_next(struct trace_reader *reader, struct trace_event *event)
+{
+    for (;;)
+    {
+        int tag = getc(reader->file);
+        if (tag == EOF)
+            return 0;
+
+        if (tag == TRACE_PATH_TAG)
+        {
+            if (read_path_record(reader) < 0)
+                return -1;
+            continue;
+        }
+
+        uint64_t path_id, target_id = 0;
+        enum trace_op op = tag & ~TRACE_FAILED_FLAG;
+        if (op >= TRACE_OP_COUNT ||
+            get_varint(reader->file, &path_id) < 0 || path_id >= reader->path_count ||
+            (op_has_target(op) && (get_varint(reader->file, &target_id) < 0 || target_id >= reader->path_count)) ||
+            get_varint(reader->file, &event->offset) < 0 ||
+            get_varint(reader->file, &event->size) < 0 ||
+            get_varint(reader->file, &event->latency_ns) < 0 ||
+            get_varint(reader->file, &event->delta_ns) < 0)
+        {
+            return -1;
+        }
+
+        event->op = op;
+        event->failed = (tag & TRACE_FAILED_FLAG) != 0;
+        event->path = reader->paths[path_id];
+        event->target = op_has_target(op) ? reader->paths[target_id] : NULL;
+        return 1;
+    }
+}
+
+void trace_reader_close(struct trace_reader *reader)
+{
+    if (!reader)
+        return;
+
+    for (uint32_t i = 0; i < reader->path_count; i++)
+    {
+        free(reader->paths[i]);
+    }
+    free(reader->paths);
+    fclose(reader->file);
+    free(reader);
+}
+
+const char *trace_op_name(enum trace_op op)
+{
+    return op < TRACE_OP_COUNT ? TRACE_OP_NAMES[op] : "unknown";
+}
@@ -0,0 +1,221 @@
+/*
+ * Analyzes a block trace written by disk_trace_dump():
+ *
+ *   ./build/blk_analyze trace.dtrc [heatmap-buckets]
+ *
+ * Reports how sequential the accesses are, how often the same block is read
+ * again without being written in between, the share of I/O per structure
+ * (superblock, bitmap, inode, directory, data, indirect) and a heatmap of
+ * accesses over the block address space.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disk.h"
+
+#define TOP_BLOCKS 10
+
+enum block_state
+{
+    BLOCK_UNTOUCHED,
+    BLOCK_READ,
+    BLOCK_WRITTEN
+};
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s trace [heatmap-buckets]\n", argv[0]);
+        return 2;
+    }
+
+    int buckets = argc > 2 ? atoi(argv[2]) : 32;
+    if (buckets < 1)
+        buckets = 1;
+
+    FILE *in = fopen(argv[1], "rb");
+    if (!in)
+    {
+        fprintf(stderr, "blk_analyze: cannot open '%s'\n", argv[1]);
+        return 1;
+    }
+
+    struct disk_trace_header header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || header.magic != DISK_TRACE_MAGIC ||
+        header.version != DISK_TRACE_VERSION || header.disk_blocks == 0)
+    {
+        fprintf(stderr, "blk_analyze: '%s' is not a block trace\n", argv[1]);
+        fclose(in);
+        return 1;
+    }
+
+    struct disk_trace_entry *entries = malloc((size_t)header.entries * sizeof(struct disk_trace_entry) + 1);
+    uint8_t *state = calloc(header.disk_blocks, 1);
+    uint32_t *read_counts = calloc(header.disk_blocks, sizeof(uint32_t));
+    uint8_t *block_tags = calloc(header.disk_blocks, 1);
+    uint64_t *heat_reads = calloc(buckets, sizeof(uint64_t));
+    uint64_t *heat_writes = calloc(buckets, sizeof(uint64_t));
+
+    if (!entries || !state || !read_counts || !block_tags || !heat_reads || !heat_writes)
+    {
+        fprintf(stderr, "blk_analyze: out of memory\n");
+        return 1;
+    }
+
+    if (fread(entries, sizeof(struct disk_trace_entry), header.entries, in) != header.entries)
+    {
+        fprintf(stderr, "blk_analyze: trace is truncated\n");
+        return 1;
+    }
+    fclose(in);
+
+    uint64_t counts[3] = {0};
+    uint64_t sequential[3] = {0};
+    uint64_t tag_reads[DISK_TAG_COUNT] = {0};
+    uint64_t tag_writes[DISK_TAG_COUNT] = {0};
+    uint64_t rereads = 0;
+    uint64_t distinct_read = 0;
+    uint64_t seek_total = 0;
+    uint64_t seeks = 0;
+    uint32_t previous_block[3] = {0};
+    int have_previous[3] = {0};
+    uint32_t last_block = 0;
+    int have_last = 0;
+    uint32_t blocks_per_bucket = (header.disk_blocks + buckets - 1) / buckets;
+
+    for (uint32_t i = 0; i < header.entries; i++)
+    {
+        struct disk_trace_entry *entry = &entries[i];
+        uint8_t op = entry->op;
+        uint8_t tag = entry->tag < DISK_TAG_COUNT ? entry->tag : DISK_TAG_UNKNOWN;
+
+        if (op > DISK_TRACE_DISCARD || entry->blocknum >= header.disk_blocks)
+            continue;
+
+        counts[op]++;
+        if (have_previous[op] && entry->blocknum == previous_block[op] + 1)
+            sequential[op]++;
+        previous_block[op] = entry->blocknum + (entry->count ? entry->count - 1 : 0);
+        have_previous[op] = 1;
+
+        if (op == DISK_TRACE_DISCARD)
+        {
+            for (uint32_t b = entry->blocknum; b < entry->blocknum + entry->count && b < header.disk_blocks; b++)
+                state[b] = BLOCK_UNTOUCHED;
+            continue;
+        }
+
+        if (have_last)
+        {
+            seek_total += entry->blocknum > last_block ? entry->blocknum - last_block : last_block - entry->blocknum;
+            seeks++;
+        }
+        last_block = entry->blocknum;
+        have_last = 1;
+        block_tags[entry->blocknum] = tag;
+
+        if (op == DISK_TRACE_READ)
+        {
+            tag_reads[tag]++;
+            heat_reads[entry->blocknum / blocks_per_bucket]++;
+
+            if (read_counts[entry->blocknum]++ == 0)
+                distinct_read++;
+            if (state[entry->blocknum] == BLOCK_READ)
+                rereads++;
+            state[entry->blocknum] = BLOCK_READ;
+        }
+        else
+        {
+            tag_writes[tag]++;
+            heat_writes[entry->blocknum / blocks_per_bucket]++;
+            state[entry->blocknum] = BLOCK_WRITTEN;
+        }
+    }
+
+    uint64_t total = counts[DISK_TRACE_READ] + counts[DISK_TRACE_WRITE];
+    double span_ms = header.entries > 1 ? (entries[header.entries - 1].timestamp_ns - entries[0].timestamp_ns) / 1e6 : 0.0;
+
+    printf("Block trace: %u entries (%llu dropped), disk %u blocks, span %.3f ms\n",
+           header.entries, (unsigned long long)header.dropped, header.disk_blocks, span_ms);
+    printf("Reads: %llu  Writes: %llu  Discards: %llu\n",
+           (unsigned long long)counts[DISK_TRACE_READ], (unsigned long long)counts[DISK_TRACE_WRITE],
+           (unsigned long long)counts[DISK_TRACE_DISCARD]);
+    printf("Sequential: reads %.1f%%  writes %.1f%%  (block = previous block of the same op + 1)\n",
+           counts[DISK_TRACE_READ] ? 100.0 * sequential[DISK_TRACE_READ] / counts[DISK_TRACE_READ] : 0.0,
+           counts[DISK_TRACE_WRITE] ? 100.0 * sequential[DISK_TRACE_WRITE] / counts[DISK_TRACE_WRITE] : 0.0);
+    printf("Mean seek distance: %.1f blocks\n", seeks ? (double)seek_total / seeks : 0.0);
+    printf("Rereads: %llu of %llu reads (%.1f%%) hit a block read before with no write in between; %llu distinct blocks read\n",
+           (unsigned long long)rereads, (unsigned long long)counts[DISK_TRACE_READ],
+           counts[DISK_TRACE_READ] ? 100.0 * rereads / counts[DISK_TRACE_READ] : 0.0,
+           (unsigned long long)distinct_read);
+
+    printf("\nMost read blocks:\n");
+    for (int k = 0; k < TOP_BLOCKS; k++)
+    {
+        uint32_t best = 0;
+        uint32_t best_count = 0;
+        for (uint32_t b = 0; b < header.disk_blocks; b++)
+        {
+            if (read_counts[b] > best_count)
+            {
+                best = b;
+                best_count = read_counts[b];
+            }
+        }
+        if (best_count <= 1)
+            break;
+
+        printf("  block %-8u %-10s %u reads\n", best, disk_tag_name(block_tags[best]), best_count);
+        read_counts[best] = 0;
+    }
+
+    printf("\nPer-structure I/O:\n");
+    printf("  %-10s %10s %10s %8s\n", "structure", "reads", "writes", "share");
+    for (int tag = 0; tag < DISK_TAG_COUNT; tag++)
+    {
+        uint64_t ops = tag_reads[tag] + tag_writes[tag];
+        if (ops == 0)
+            continue;
+
+        printf("  %-10s %10llu %10llu %7.1f%%\n", disk_tag_name(tag),
+               (unsigned long long)tag_reads[tag], (unsigned long long)tag_writes[tag],
+               total ? 100.0 * ops / total : 0.0);
+    }
+
+    uint64_t max_heat = 1;
+    for (int i = 0; i < buckets; i++)
+    {
+        if (heat_reads[i] + heat_writes[i] > max_heat)
+            max_heat = heat_reads[i] + heat_writes[i];
+    }
+
+    printf("\nHeatmap (%u blocks per row, R = reads, W = writes):\n", blocks_per_bucket);
+    for (int i = 0; i < buckets; i++)
+    {
+        uint64_t first = (uint64_t)i * blocks_per_bucket;
+        if (first >= header.disk_blocks)
+            break;
+
+        int read_width = (int)(50 * heat_reads[i] / max_heat);
+        int write_width = (int)(50 * heat_writes[i] / max_heat);
+        printf("  %8llu %8llu %8llu |", (unsigned long long)first,
+               (unsigned long long)heat_reads[i], (unsigned long long)heat_writes[i]);
+        for (int c = 0; c < read_width; c++)
+            putchar('R');
+        for (int c = 0; c < write_width; c++)
+            putchar('W');
+        putchar('\n');
+    }
+
+    free(entries);
+    free(state);
+    free(read_counts);
+    free(block_tags);
+    free(heat_reads);
+    free(heat_writes);
+    return 0;
+}
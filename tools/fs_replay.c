@@ -0,0 +1,208 @@
+/*
+ * Replays an operation trace recorded with fs_trace_start() against a fresh
+ * disk image and reports per-operation latency percentiles, next to the
+ * latencies observed when the trace was captured:
+ *
+ *   ./build/fs_replay trace.bin [image-path] [blocks]
+ *
+ * Operations are issued back to back; the recorded think time between calls
+ * is not reproduced. Written data is a fixed byte pattern.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs.h"
+#include "disk.h"
+#include "trace.h"
+
+struct latency_set
+{
+    uint64_t *values;
+    size_t count;
+    size_t capacity;
+};
+
+struct op_result
+{
+    struct latency_set replayed;
+    struct latency_set traced;
+    uint64_t errors;
+    uint64_t traced_errors;
+};
+
+static int add_latency(struct latency_set *set, uint64_t value)
+{
+    if (set->count == set->capacity)
+    {
+        size_t new_capacity = set->capacity ? set->capacity * 2 : 1024;
+        uint64_t *values = realloc(set->values, new_capacity * sizeof(uint64_t));
+        if (!values)
+            return -1;
+        set->values = values;
+        set->capacity = new_capacity;
+    }
+
+    set->values[set->count++] = value;
+    return 0;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const struct latency_set *set, double p)
+{
+    if (set->count == 0)
+        return 0;
+
+    size_t index = (size_t)(p * (set->count - 1) + 0.5);
+    return set->values[index];
+}
+
+static void print_result(enum trace_op op, struct op_result *result)
+{
+    struct latency_set *replayed = &result->replayed;
+    struct latency_set *traced = &result->traced;
+
+    qsort(replayed->values, replayed->count, sizeof(uint64_t), compare_u64);
+    qsort(traced->values, traced->count, sizeof(uint64_t), compare_u64);
+
+    printf("{\"op\":\"%s\",\"count\":%zu,\"errors\":%llu,\"traced_errors\":%llu,"
+           "\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"max_ns\":%llu,"
+           "\"traced_p50_ns\":%llu,\"traced_p99_ns\":%llu}\n",
+           trace_op_name(op), replayed->count,
+           (unsigned long long)result->errors, (unsigned long long)result->traced_errors,
+           (unsigned long long)percentile(replayed, 0.50), (unsigned long long)percentile(replayed, 0.90),
+           (unsigned long long)percentile(replayed, 0.99), (unsigned long long)percentile(replayed, 1.0),
+           (unsigned long long)percentile(traced, 0.50), (unsigned long long)percentile(traced, 0.99));
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s trace [image] [blocks]\n", argv[0]);
+        return 2;
+    }
+
+    char *image_path = argc > 2 ? argv[2] : "replay.img";
+    int blocks = argc > 3 ? atoi(argv[3]) : 8192;
+
+    struct trace_reader *reader = trace_reader_open(argv[1]);
+    if (!reader)
+    {
+        fprintf(stderr, "fs_replay: '%s' is not a readable trace\n", argv[1]);
+        return 1;
+    }
+
+    if (disk_init(image_path, blocks) < 0 || fs_format() < 0 || fs_mount() < 0)
+    {
+        fprintf(stderr, "fs_replay: could not prepare image '%s'\n", image_path);
+        trace_reader_close(reader);
+        return 1;
+    }
+    fs_set_log_level(FS_LOG_OFF);
+
+    struct op_result results[TRACE_OP_COUNT] = {0};
+    char *buf = NULL;
+    size_t buf_size = 0;
+    struct trace_event event;
+    int status;
+
+    while ((status = trace_reader_next(reader, &event)) > 0)
+    {
+        // Only reads and writes move data; fallocate's size is a length.
+        int moves_data = event.op == TRACE_READ || event.op == TRACE_WRITE || event.op == TRACE_APPEND ||
+                         event.op == TRACE_PWRITE;
+        if (moves_data && event.size > buf_size)
+        {
+            char *grown = realloc(buf, event.size);
+            if (!grown)
+            {
+                fprintf(stderr, "fs_replay: out of memory\n");
+                return 1;
+            }
+            buf = grown;
+            memset(buf + buf_size, 0x5A, event.size - buf_size);
+            buf_size = event.size;
+        }
+
+        long result = 0;
+        uint64_t start = stats_now_ns();
+
+        switch (event.op)
+        {
+        case TRACE_CREATE:
+            result = fs_create(event.path, 0);
+            break;
+        case TRACE_MKDIR:
+            result = fs_create(event.path, 1);
+            break;
+        case TRACE_READ:
+            result = fs_read(event.path, buf, event.size, event.offset);
+            break;
+        case TRACE_WRITE:
+            result = fs_write(event.path, buf, event.size, 0);
+            break;
+        case TRACE_APPEND:
+            result = fs_write(event.path, buf, event.size, 1);
+            break;
+        case TRACE_PWRITE:
+            result = fs_pwrite(event.path, buf, event.size, event.offset);
+            break;
+        case TRACE_REMOVE:
+            result = fs_remove(event.path);
+            break;
+        case TRACE_TRUNCATE:
+            result = fs_truncate(event.path, event.offset);
+            break;
+        case TRACE_RENAME:
+            result = fs_rename(event.path, event.target);
+            break;
+        case TRACE_CLONE:
+            result = fs_clone(event.path, event.target);
+            break;
+        case TRACE_FALLOCATE:
+            result = fs_fallocate(event.path, event.offset, event.size);
+            break;
+        default:
+            break;
+        }
+
+        uint64_t elapsed = stats_now_ns() - start;
+        struct op_result *op_result = &results[event.op];
+
+        if (add_latency(&op_result->replayed, elapsed) < 0 || add_latency(&op_result->traced, event.latency_ns) < 0)
+        {
+            fprintf(stderr, "fs_replay: out of memory\n");
+            return 1;
+        }
+        if (result < 0)
+            op_result->errors++;
+        if (event.failed)
+            op_result->traced_errors++;
+    }
+
+    if (status < 0)
+        fprintf(stderr, "fs_replay: trace is truncated or corrupt, report covers the readable prefix\n");
+
+    for (int op = 0; op < TRACE_OP_COUNT; op++)
+    {
+        if (results[op].replayed.count > 0)
+            print_result(op, &results[op]);
+        free(results[op].replayed.values);
+        free(results[op].traced.values);
+    }
+
+    free(buf);
+    trace_reader_close(reader);
+    fs_unmount();
+    disk_close(0);
+    remove(image_path);
+    return status < 0 ? 1 : 0;
+}
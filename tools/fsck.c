@@ -0,0 +1,819 @@
+/*
+ * Checks, and optionally repairs, an unmounted disk image:
+ *
+ *   ./build/fsck [-y] [-j threads] image
+ *
+ * The image is read into memory with large sequential reads, verifying the
+ * block checksums appended by disk_close() on the way. The checker then walks
+ * the directory tree from the root and scans the live and snapshot inode
+ * tables to work out which blocks and inodes are really in use, and compares
+ * that with the bitmaps and the reference count table. It reports:
+ *
+ *   - blocks whose checksum does not match their contents,
+ *   - directory entries with a bad name, an out-of-range or free inode, a
+ *     duplicate name, a wrong "." or "..", or a second link to an inode,
+ *   - allocated inodes that no directory entry reaches,
+ *   - block pointers that leave the data area, point at metadata, or hold a
+ *     compression marker where none may be,
+ *   - blocks in use but marked free, and marked in use but owned by nobody,
+ *   - reference counts that differ from the number of owners, including
+ *     blocks owned twice without being accounted as shared.
+ *
+ * With -y the problems are fixed in place: bad entries and pointers are
+ * cleared, orphaned inodes are freed, and the bitmaps, reference counts and
+ * checksums are rewritten to match. Snapshots are only checked and never
+ * reshaped, except that a pointer no reader could follow is cleared.
+ *
+ * The inode tables are scanned in ranges and the directory tree in subtrees,
+ * spread over the worker threads.
+ *
+ * Exit status: 0 if the image is clean, 1 if all problems were fixed, 4 if
+ * problems remain, 8 if the image could not be checked.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "fs.h"
+#include "crc32c.h"
+
+#define LOAD_CHUNK_BLOCKS 256 // 1 MiB per read
+#define INODE_CHUNK 1024
+#define MAX_THREADS 64
+#define MAX_MESSAGES 1000
+
+#define BIT_TEST(bitmap, index) (((bitmap)[(index) / 32] >> ((index) % 32)) & 1u)
+#define BIT_SET(bitmap, index) ((bitmap)[(index) / 32] |= 1u << ((index) % 32))
+#define BIT_CLEAR(bitmap, index) ((bitmap)[(index) / 32] &= ~(1u << ((index) % 32)))
+
+#define INODES_PER_BLOCK (BLOCK_SIZE / sizeof(struct inode))
+#define REFCOUNTS_PER_BLOCK (BLOCK_SIZE / sizeof(uint16_t))
+
+/*
+ * A set of inodes that owns blocks: the live table or a snapshot's frozen copy.
+ */
+struct volume_root
+{
+    const char *name;
+    uint32_t inode_table_start;
+    uint32_t *inode_bitmap;
+};
+
+struct dir_work
+{
+    uint32_t inode;
+    uint32_t parent;
+};
+
+static int fd = -1;
+static int repair = 0;
+static int thread_count = 1;
+
+static union block *image;
+static uint32_t blocks;
+static uint32_t *checksums;     // the image's checksum table, or NULL if it has none
+static uint8_t *dirty;          // blocks to write back
+static struct superblock *sb;
+static uint32_t total_inodes;
+
+static struct volume_root roots[1 + FS_MAX_SNAPSHOTS];
+static int root_count;
+
+static uint8_t *metadata;       // 1 for blocks owned by the filesystem itself
+static uint32_t *refs;          // number of pointers to each block
+static uint8_t *indirect_seen;  // indirect blocks whose pointers were counted
+static uint32_t *links;         // number of directory entries per live inode
+
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t problems;
+static uint64_t fixed;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct dir_work *queue;
+static size_t queue_size;
+static size_t queue_capacity;
+static int queue_busy;
+
+static uint64_t next_item;
+static uint64_t item_count;
+static void (*item_work)(uint64_t item);
+
+/**
+ * Reports a problem. `fixable` says whether -y repairs it; the caller makes
+ * the repair itself when `repair` is set.
+ */
+static void problem(int fixable, const char *fmt, ...)
+{
+    pthread_mutex_lock(&report_lock);
+
+    if (problems < MAX_MESSAGES)
+    {
+        va_list args;
+        va_start(args, fmt);
+        vprintf(fmt, args);
+        va_end(args);
+        printf(repair && fixable ? " (fixed)\n" : "\n");
+    }
+    else if (problems == MAX_MESSAGES)
+    {
+        printf("... further problems not shown\n");
+    }
+
+    problems++;
+    if (repair && fixable)
+        fixed++;
+
+    pthread_mutex_unlock(&report_lock);
+}
+
+static void mark_dirty(const void *p)
+{
+    uint32_t b = (uint32_t)(((const uint8_t *)p - image->data) / BLOCK_SIZE);
+    __atomic_store_n(&dirty[b], 1, __ATOMIC_RELAXED);
+}
+
+static void *item_worker(void *arg)
+{
+    (void)arg;
+    uint64_t item;
+    while ((item = __atomic_fetch_add(&next_item, 1, __ATOMIC_RELAXED)) < item_count)
+    {
+        item_work(item);
+    }
+    return NULL;
+}
+
+/**
+ * Calls `work` for items 0 .. count-1, spread over the worker threads.
+ */
+static void run_parallel(uint64_t count, void (*work)(uint64_t item))
+{
+    pthread_t threads[MAX_THREADS];
+    int started = 0;
+
+    next_item = 0;
+    item_count = count;
+    item_work = work;
+
+    for (int t = 1; t < thread_count; t++)
+    {
+        if (pthread_create(&threads[started], NULL, item_worker, NULL) == 0)
+            started++;
+    }
+    item_worker(NULL);
+
+    for (int t = 0; t < started; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+}
+
+/* ---- Pass 1: load the image and verify checksums ---- */
+
+static void load_chunk(uint64_t chunk)
+{
+    uint32_t first = (uint32_t)chunk * LOAD_CHUNK_BLOCKS;
+    uint32_t count = blocks - first < LOAD_CHUNK_BLOCKS ? blocks - first : LOAD_CHUNK_BLOCKS;
+    size_t len = (size_t)count * BLOCK_SIZE;
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t n = pread(fd, image[first].data + done, len - done, (off_t)first * BLOCK_SIZE + done);
+        if (n <= 0)
+        {
+            problem(0, "Blocks %u-%u: read failed", first, first + count - 1);
+            memset(image[first].data + done, 0, len - done);
+            return;
+        }
+        done += n;
+    }
+
+    if (!checksums)
+        return;
+
+    for (uint32_t b = first; b < first + count; b++)
+    {
+        if (crc32c(0, image[b].data, BLOCK_SIZE) != checksums[b])
+            problem(0, "Block %u: checksum mismatch", b);
+    }
+}
+
+/* ---- Superblock ---- */
+
+static int block_in_data(uint32_t b)
+{
+    return b >= sb->s_data_blocks_start && b < blocks;
+}
+
+static int check_superblock()
+{
+    uint32_t refcount_blocks = (blocks + REFCOUNTS_PER_BLOCK - 1) / REFCOUNTS_PER_BLOCK;
+
+    if (sb->s_blocks_count != blocks || sb->s_block_bitmap == 0 || sb->s_inode_bitmap == 0 ||
+        sb->s_inode_table_block_start == 0 || sb->s_block_bitmap >= sb->s_inode_table_block_start ||
+        sb->s_inode_bitmap >= sb->s_inode_table_block_start ||
+        sb->s_unwritten_bitmap >= sb->s_inode_table_block_start ||
+        sb->s_data_blocks_start <= sb->s_inode_table_block_start || sb->s_data_blocks_start >= blocks)
+    {
+        fprintf(stderr, "fsck: superblock layout is invalid\n");
+        return -1;
+    }
+
+    total_inodes = (sb->s_data_blocks_start - sb->s_inode_table_block_start) * INODES_PER_BLOCK;
+    if (sb->s_inodes_count > total_inodes)
+    {
+        fprintf(stderr, "fsck: superblock claims %u inodes, the table holds %u\n", sb->s_inodes_count, total_inodes);
+        return -1;
+    }
+
+    if (sb->s_refcount_table_start != 0 &&
+        (!block_in_data(sb->s_refcount_table_start) || sb->s_refcount_table_blocks != refcount_blocks ||
+         sb->s_refcount_table_start + refcount_blocks > blocks))
+    {
+        fprintf(stderr, "fsck: reference count table location is invalid\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Collects the live table and every snapshot, and marks the blocks the
+ * filesystem owns directly: the fixed layout, the reference count table and
+ * the snapshots' frozen tables and bitmaps.
+ */
+static void collect_roots()
+{
+    uint32_t table_blocks = sb->s_data_blocks_start - sb->s_inode_table_block_start;
+
+    for (uint32_t b = 0; b < sb->s_data_blocks_start; b++)
+    {
+        metadata[b] = 1;
+    }
+    for (uint32_t i = 0; sb->s_refcount_table_start != 0 && i < sb->s_refcount_table_blocks; i++)
+    {
+        metadata[sb->s_refcount_table_start + i] = 1;
+    }
+
+    roots[0].name = "live";
+    roots[0].inode_table_start = sb->s_inode_table_block_start;
+    roots[0].inode_bitmap = image[sb->s_inode_bitmap].bitmap;
+    root_count = 1;
+
+    for (int s = 0; s < FS_MAX_SNAPSHOTS; s++)
+    {
+        struct snapshot_record *record = &sb->s_snapshots[s];
+        if (record->inode_table_start == 0)
+            continue;
+
+        record->name[FS_SNAPSHOT_NAME_LEN - 1] = '\0';
+        if (!block_in_data(record->inode_table_start) || record->inode_table_start + table_blocks > blocks ||
+            !block_in_data(record->inode_bitmap))
+        {
+            problem(0, "Snapshot '%s': table location is invalid, snapshot ignored", record->name);
+            continue;
+        }
+
+        for (uint32_t i = 0; i < table_blocks; i++)
+        {
+            metadata[record->inode_table_start + i] = 1;
+        }
+        metadata[record->inode_bitmap] = 1;
+
+        roots[root_count].name = record->name;
+        roots[root_count].inode_table_start = record->inode_table_start;
+        roots[root_count].inode_bitmap = image[record->inode_bitmap].bitmap;
+        root_count++;
+    }
+}
+
+static struct inode *root_inode(const struct volume_root *root, uint32_t index)
+{
+    return &image[root->inode_table_start + index / INODES_PER_BLOCK].inodes[index % INODES_PER_BLOCK];
+}
+
+/* ---- Pass 2: directory tree ---- */
+
+static void queue_push(uint32_t inode, uint32_t parent)
+{
+    pthread_mutex_lock(&queue_lock);
+    if (queue_size == queue_capacity)
+    {
+        size_t capacity = queue_capacity ? queue_capacity * 2 : 256;
+        struct dir_work *grown = realloc(queue, capacity * sizeof(struct dir_work));
+        if (!grown)
+        {
+            fprintf(stderr, "fsck: out of memory\n");
+            exit(8);
+        }
+        queue = grown;
+        queue_capacity = capacity;
+    }
+    queue[queue_size++] = (struct dir_work){inode, parent};
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const struct directory_entry *x = *(const struct directory_entry *const *)a;
+    const struct directory_entry *y = *(const struct directory_entry *const *)b;
+    int order = strncmp(x->name, y->name, MAX_NAME_LEN);
+    return order ? order : (x > y) - (x < y);
+}
+
+static void drop_entry(struct directory_entry *entry)
+{
+    if (!repair)
+        return;
+
+    memset(entry, 0, sizeof(*entry));
+    mark_dirty(entry);
+}
+
+/**
+ * Checks the entries of one directory and queues its subdirectories.
+ */
+static void check_directory(uint32_t dir, uint32_t parent)
+{
+    struct inode *dir_inode = root_inode(&roots[0], dir);
+    struct directory_entry *names[INODE_DIRECT_POINTERS * DIRENTS_PER_BLOCK];
+    size_t name_count = 0;
+
+    for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+    {
+        uint32_t b = dir_inode->i_direct_pointers[dp];
+        if (!block_in_data(b) || metadata[b])
+            continue;
+
+        struct directory_entry *entries = image[b].directory_entries;
+        for (unsigned int i = 0; i < DIRENTS_PER_BLOCK; i++)
+        {
+            struct directory_entry *entry = &entries[i];
+            uint32_t child = entry->inode;
+            if (child == 0)
+                continue;
+
+            if (entry->name[0] == '\0' || memchr(entry->name, '\0', MAX_NAME_LEN) == NULL ||
+                strchr(entry->name, '/') != NULL)
+            {
+                problem(1, "Directory %u: entry for inode %u has an invalid name", dir, child);
+                drop_entry(entry);
+                continue;
+            }
+
+            if (strcmp(entry->name, ".") == 0 || strcmp(entry->name, "..") == 0)
+            {
+                uint32_t expected = entry->name[1] ? parent : dir;
+                if (child != expected)
+                {
+                    problem(1, "Directory %u: '%s' points to inode %u instead of %u", dir, entry->name, child, expected);
+                    drop_entry(entry);
+                }
+                continue;
+            }
+
+            if (child >= sb->s_inodes_count)
+            {
+                problem(1, "Directory %u: '%s' points to inode %u, past the inode table", dir, entry->name, child);
+                drop_entry(entry);
+                continue;
+            }
+
+            if (!BIT_TEST(roots[0].inode_bitmap, child))
+            {
+                problem(1, "Directory %u: '%s' points to free inode %u", dir, entry->name, child);
+                drop_entry(entry);
+                continue;
+            }
+
+            if (__atomic_fetch_add(&links[child], 1, __ATOMIC_RELAXED) != 0)
+            {
+                problem(1, "Directory %u: '%s' is a second link to inode %u", dir, entry->name, child);
+                drop_entry(entry);
+                continue;
+            }
+
+            names[name_count++] = entry;
+            if (root_inode(&roots[0], child)->i_is_directory)
+                queue_push(child, dir);
+        }
+    }
+
+    // Names must be unique within the directory; the first entry wins.
+    qsort(names, name_count, sizeof(names[0]), compare_entries);
+    for (size_t i = 1; i < name_count; i++)
+    {
+        if (strncmp(names[i]->name, names[i - 1]->name, MAX_NAME_LEN) == 0)
+        {
+            problem(1, "Directory %u: duplicate name '%s' for inode %u", dir, names[i]->name, names[i]->inode);
+            drop_entry(names[i]);
+        }
+    }
+}
+
+static void *directory_worker(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&queue_lock);
+
+    for (;;)
+    {
+        while (queue_size == 0 && queue_busy > 0)
+        {
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        }
+        if (queue_size == 0)
+            break;
+
+        struct dir_work work = queue[--queue_size];
+        queue_busy++;
+        pthread_mutex_unlock(&queue_lock);
+
+        check_directory(work.inode, work.parent);
+
+        pthread_mutex_lock(&queue_lock);
+        queue_busy--;
+        if (queue_busy == 0 && queue_size == 0)
+            pthread_cond_broadcast(&queue_cond);
+    }
+
+    pthread_mutex_unlock(&queue_lock);
+    return NULL;
+}
+
+/**
+ * Walks the live directory tree. Each worker takes a directory off the shared
+ * queue and pushes its subdirectories back, so subtrees spread over threads.
+ */
+static void check_tree()
+{
+    pthread_t threads[MAX_THREADS];
+    int started = 0;
+
+    queue_push(0, 0);
+    for (int t = 1; t < thread_count; t++)
+    {
+        if (pthread_create(&threads[started], NULL, directory_worker, NULL) == 0)
+            started++;
+    }
+    directory_worker(NULL);
+
+    for (int t = 0; t < started; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+    free(queue);
+}
+
+static void check_orphans()
+{
+    for (uint32_t i = 1; i < total_inodes; i++)
+    {
+        if (!BIT_TEST(roots[0].inode_bitmap, i))
+            continue;
+
+        if (i >= sb->s_inodes_count)
+        {
+            problem(1, "Inode %u: allocated past the inode count", i);
+        }
+        else if (links[i] == 0)
+        {
+            problem(1, "Inode %u: allocated but not linked from any directory", i);
+        }
+        else
+        {
+            continue;
+        }
+
+        if (repair)
+        {
+            BIT_CLEAR(roots[0].inode_bitmap, i);
+            memset(root_inode(&roots[0], i), 0, sizeof(struct inode));
+            mark_dirty(roots[0].inode_bitmap);
+            mark_dirty(root_inode(&roots[0], i));
+        }
+    }
+}
+
+/* ---- Pass 3: block ownership ---- */
+
+/**
+ * Counts one block pointer. `marker_ok` says whether the slot may hold the
+ * compressed cluster marker, which fills the tail of a compressed cluster.
+ */
+static void count_pointer(const struct volume_root *root, uint32_t inode, uint32_t *slot, int marker_ok)
+{
+    uint32_t b = *slot;
+    if (b == 0 || (b == FS_PTR_COMPRESSED && marker_ok))
+        return;
+
+    if (b == FS_PTR_COMPRESSED)
+    {
+        problem(1, "Inode %u (%s): compression marker outside a compressed cluster", inode, root->name);
+    }
+    else if (!block_in_data(b))
+    {
+        problem(1, "Inode %u (%s): block pointer %u is outside the data area", inode, root->name, b);
+    }
+    else if (metadata[b])
+    {
+        problem(1, "Inode %u (%s): block %u is filesystem metadata", inode, root->name, b);
+    }
+    else
+    {
+        __atomic_fetch_add(&refs[b], 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (repair)
+    {
+        *slot = 0;
+        mark_dirty(slot);
+    }
+}
+
+static void count_inode(const struct volume_root *root, uint32_t index)
+{
+    struct inode *inode = root_inode(root, index);
+    int compressed = (inode->i_flags & FS_INODE_COMPRESSED) && !inode->i_is_directory;
+
+    for (int dp = 0; dp < INODE_DIRECT_POINTERS; dp++)
+    {
+        count_pointer(root, index, &inode->i_direct_pointers[dp], compressed && dp % FS_CLUSTER_BLOCKS != 0);
+    }
+
+    uint32_t indirect = inode->i_indirect_pointer;
+    count_pointer(root, index, &inode->i_indirect_pointer, 0);
+    if (inode->i_indirect_pointer == 0 || indirect == FS_PTR_COMPRESSED || !block_in_data(indirect) || metadata[indirect])
+        return;
+
+    // A shared indirect block holds one reference to each block it lists.
+    if (__atomic_exchange_n(&indirect_seen[indirect], 1, __ATOMIC_RELAXED))
+        return;
+
+    uint32_t *pointers = image[indirect].pointers;
+    for (unsigned int i = 0; i < MAX_POINTERS; i++)
+    {
+        size_t logical = INODE_DIRECT_POINTERS + i;
+        count_pointer(root, index, &pointers[i], compressed && logical % FS_CLUSTER_BLOCKS != 0);
+    }
+}
+
+static void count_chunk(uint64_t item)
+{
+    uint64_t chunks_per_root = (total_inodes + INODE_CHUNK - 1) / INODE_CHUNK;
+    const struct volume_root *root = &roots[item / chunks_per_root];
+    uint32_t first = (uint32_t)(item % chunks_per_root) * INODE_CHUNK;
+    uint32_t last = first + INODE_CHUNK < total_inodes ? first + INODE_CHUNK : total_inodes;
+
+    for (uint32_t i = first; i < last; i++)
+    {
+        if (BIT_TEST(root->inode_bitmap, i))
+            count_inode(root, i);
+    }
+}
+
+static void set_bit(uint32_t *bitmap, uint32_t index, int value)
+{
+    if (!repair)
+        return;
+
+    if (value)
+        BIT_SET(bitmap, index);
+    else
+        BIT_CLEAR(bitmap, index);
+    mark_dirty(bitmap);
+}
+
+/**
+ * Compares what the scan found with the block bitmap, the unwritten bitmap
+ * and the reference count table.
+ */
+static void check_blocks()
+{
+    uint32_t *block_bitmap = image[sb->s_block_bitmap].bitmap;
+    uint32_t *unwritten = sb->s_unwritten_bitmap ? image[sb->s_unwritten_bitmap].bitmap : NULL;
+    uint16_t *refcounts = NULL;
+
+    if (sb->s_refcount_table_start != 0)
+    {
+        refcounts = malloc((size_t)sb->s_refcount_table_blocks * BLOCK_SIZE);
+        if (!refcounts)
+        {
+            fprintf(stderr, "fsck: out of memory\n");
+            exit(8);
+        }
+        memcpy(refcounts, &image[sb->s_refcount_table_start], (size_t)sb->s_refcount_table_blocks * BLOCK_SIZE);
+    }
+
+    for (uint32_t b = 0; b < blocks; b++)
+    {
+        int used = metadata[b] || refs[b] > 0;
+
+        if (used && !BIT_TEST(block_bitmap, b))
+        {
+            problem(1, "Block %u: in use but marked free", b);
+            set_bit(block_bitmap, b, 1);
+        }
+        else if (!used && BIT_TEST(block_bitmap, b))
+        {
+            problem(1, "Block %u: marked in use but not referenced", b);
+            set_bit(block_bitmap, b, 0);
+        }
+
+        if (unwritten && BIT_TEST(unwritten, b) && refs[b] == 0)
+        {
+            problem(1, "Block %u: unwritten flag on a block no file owns", b);
+            set_bit(unwritten, b, 0);
+        }
+
+        uint32_t expected = refs[b] > 0 ? refs[b] - 1 : 0;
+        uint32_t recorded = refcounts ? refcounts[b] : 0;
+        if (expected == recorded)
+            continue;
+
+        if (expected > UINT16_MAX)
+        {
+            problem(0, "Block %u: %u owners exceed the reference count limit", b, refs[b]);
+        }
+        else if (!refcounts)
+        {
+            problem(0, "Block %u: owned %u times but the volume has no reference count table", b, refs[b]);
+        }
+        else
+        {
+            if (recorded == 0)
+                problem(1, "Block %u: owned %u times but not accounted as shared", b, refs[b]);
+            else
+                problem(1, "Block %u: reference count %u, expected %u", b, recorded, expected);
+
+            if (repair)
+            {
+                refcounts[b] = (uint16_t)expected;
+                mark_dirty(&image[sb->s_refcount_table_start + b / REFCOUNTS_PER_BLOCK]);
+            }
+        }
+    }
+
+    if (refcounts && repair)
+        memcpy(&image[sb->s_refcount_table_start], refcounts, (size_t)sb->s_refcount_table_blocks * BLOCK_SIZE);
+    free(refcounts);
+}
+
+/* ---- Write-back ---- */
+
+static int write_back()
+{
+    int result = 0;
+
+    for (uint32_t b = 0; b < blocks; b++)
+    {
+        if (!dirty[b])
+            continue;
+
+        if (pwrite(fd, image[b].data, BLOCK_SIZE, (off_t)b * BLOCK_SIZE) != BLOCK_SIZE)
+            result = -1;
+
+        if (checksums)
+        {
+            checksums[b] = crc32c(0, image[b].data, BLOCK_SIZE);
+            if (pwrite(fd, &checksums[b], sizeof(uint32_t), (off_t)blocks * BLOCK_SIZE + (off_t)b * sizeof(uint32_t)) !=
+                sizeof(uint32_t))
+                result = -1;
+        }
+    }
+
+    if (fsync(fd) != 0)
+        result = -1;
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = online > 0 ? (int)online : 1;
+
+    while ((opt = getopt(argc, argv, "yj:")) != -1)
+    {
+        if (opt == 'y')
+            repair = 1;
+        else if (opt == 'j')
+            thread_count = atoi(optarg);
+        else
+            optind = argc + 1;
+    }
+
+    if (optind != argc - 1)
+    {
+        fprintf(stderr, "usage: %s [-y] [-j threads] image\n", argv[0]);
+        return 8;
+    }
+    if (thread_count < 1)
+        thread_count = 1;
+    if (thread_count > MAX_THREADS)
+        thread_count = MAX_THREADS;
+
+    fd = open(argv[optind], repair ? O_RDWR : O_RDONLY);
+    struct stat st;
+    union block first;
+    if (fd < 0 || fstat(fd, &st) != 0 || pread(fd, &first, BLOCK_SIZE, 0) != BLOCK_SIZE)
+    {
+        fprintf(stderr, "fsck: cannot read '%s'\n", argv[optind]);
+        return 8;
+    }
+
+    blocks = first.superblock.s_blocks_count;
+    if (blocks < 8 || (uint64_t)st.st_size < (uint64_t)blocks * BLOCK_SIZE)
+    {
+        fprintf(stderr, "fsck: '%s' is not a filesystem image\n", argv[optind]);
+        return 8;
+    }
+
+    uint64_t start = stats_now_ns();
+    image = aligned_alloc(BLOCK_SIZE, (size_t)blocks * BLOCK_SIZE);
+    dirty = calloc(blocks, 1);
+    metadata = calloc(blocks, 1);
+    refs = calloc(blocks, sizeof(uint32_t));
+    indirect_seen = calloc(blocks, 1);
+    if (!image || !dirty || !metadata || !refs || !indirect_seen)
+    {
+        fprintf(stderr, "fsck: out of memory\n");
+        return 8;
+    }
+
+    // The checksum table follows the last block when the image has one.
+    if ((uint64_t)st.st_size == (uint64_t)blocks * (BLOCK_SIZE + sizeof(uint32_t)))
+    {
+        checksums = malloc((size_t)blocks * sizeof(uint32_t));
+        if (!checksums ||
+            pread(fd, checksums, (size_t)blocks * sizeof(uint32_t), (off_t)blocks * BLOCK_SIZE) !=
+                (ssize_t)((size_t)blocks * sizeof(uint32_t)))
+        {
+            fprintf(stderr, "fsck: cannot read the checksum table\n");
+            return 8;
+        }
+    }
+
+    printf("Pass 1: reading %u blocks%s\n", blocks, checksums ? " and verifying checksums" : "");
+    run_parallel((blocks + LOAD_CHUNK_BLOCKS - 1) / LOAD_CHUNK_BLOCKS, load_chunk);
+
+    sb = &image[0].superblock;
+    if (check_superblock() < 0)
+        return 8;
+    collect_roots();
+
+    links = calloc(total_inodes, sizeof(uint32_t));
+    if (!links)
+    {
+        fprintf(stderr, "fsck: out of memory\n");
+        return 8;
+    }
+
+    printf("Pass 2: checking directory tree\n");
+    struct inode *root_dir = root_inode(&roots[0], 0);
+    if (!BIT_TEST(roots[0].inode_bitmap, 0) || !root_dir->i_is_directory)
+    {
+        problem(0, "Root directory inode is missing");
+    }
+    else
+    {
+        check_tree();
+        check_orphans();
+    }
+
+    printf("Pass 3: checking block ownership in %d inode table%s\n", root_count, root_count > 1 ? "s" : "");
+    run_parallel((uint64_t)root_count * ((total_inodes + INODE_CHUNK - 1) / INODE_CHUNK), count_chunk);
+    check_blocks();
+
+    int status = problems == 0 ? 0 : problems == fixed ? 1 : 4;
+    if (repair && fixed > 0 && write_back() < 0)
+    {
+        fprintf(stderr, "fsck: failed to write repairs\n");
+        status = 8;
+    }
+
+    printf("%s: %llu problem%s, %llu fixed; %u blocks, %u inodes in %.1f ms with %d thread%s\n",
+           argv[optind], (unsigned long long)problems, problems == 1 ? "" : "s", (unsigned long long)fixed,
+           blocks, total_inodes, (stats_now_ns() - start) / 1e6, thread_count, thread_count == 1 ? "" : "s");
+
+    close(fd);
+    free(image);
+    free(dirty);
+    free(metadata);
+    free(refs);
+    free(indirect_seen);
+    free(links);
+    free(checksums);
+    return status;
+}